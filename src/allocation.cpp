@@ -29,6 +29,7 @@
 #include <ini.h>
 #include <iostream> // TODO: debug-only
 #include <set>
+#include <sstream>
 
 #ifdef _DEBUG
   #include <iomanip>
@@ -122,11 +123,71 @@ size_t Allocation::GetMaxDeals() const
   return maxDeals_;
 }
 
+size_t Allocation::GetAlternatives() const
+{
+  return alternatives_;
+}
+
 bool Allocation::UseLeastSquaresApproximation() const
 {
   return useLeastSquares_;
 }
 
+bool Allocation::UseExactLeastSquares() const
+{
+  return exactLeastSquares_;
+}
+
+const std::string &Allocation::GetSolverName() const
+{
+  return solverName_;
+}
+
+size_t Allocation::GetThreads() const
+{
+  return threads_;
+}
+
+double Allocation::GetTimeLimit() const
+{
+  return timeLimit_;
+}
+
+const MIPSolver::Options &Allocation::GetSolverOptions() const
+{
+  return solverOptions_;
+}
+
+MIPSolver::Encoding Allocation::GetEncoding() const
+{
+  return encoding_;
+}
+
+double Allocation::GetRefPointTolerance() const
+{
+  return refPointTolerance_;
+}
+
+double Allocation::GetRelativeRefPointTolerance() const
+{
+  return relativeRefPointTolerance_;
+}
+
+size_t Allocation::GetMaxIterations() const
+{
+  return maxIterations_;
+}
+
+bool Allocation::UseMultiscaleRefPoints() const
+{
+  return multiscaleRefPoints_;
+}
+
+bool Allocation::UseRoundingHeuristic() const
+{
+  return roundingHeuristic_;
+}
+
 const std::string &Allocation::GetProviderName() const
 {
   return providerName_;
@@ -158,7 +219,12 @@ void Allocation::Dump() const
   std::cout << "Options:" << std::endl;
   if (noMoreDeals_) std::cout << "  Use all cash" << std::endl;
   if (maxDeals_ > 0) std::cout << "  Max deals: " << maxDeals_ << std::endl;
-  std::cout << "  Model: " << (useLeastSquares_ ? "LS" : "LAD") << std::endl;
+  if (alternatives_ > 0) std::cout << "  Alternatives: " << alternatives_ << std::endl;
+  std::cout << "  Model: " << (useLeastSquares_ ? (exactLeastSquares_ ? "LS" : "LSAPPROX") : "LAD") << std::endl;
+  std::cout << "  Solver: " << solverName_ << std::endl;
+  std::cout << "  Threads: " << threads_ << std::endl;
+  if (timeLimit_ > 0) std::cout << "  Time limit: " << timeLimit_ << std::endl;
+  if (solverOptions_.mipGap > 0) std::cout << "  MIP gap: " << solverOptions_.mipGap << std::endl;
 }
 #endif
 
@@ -302,21 +368,44 @@ bool Allocation::LoadHandler(LoadContext &ctx, std::string section, std::string
     {
       if (!StringToULong(value, maxDeals_)) return false;
     }
+    else if (name == "ALTERNATIVES")
+    {
+      if (!StringToULong(value, alternatives_)) return false;
+    }
     else if (name == "MODEL")
     {
       if (value == "LAD")
       {
         useLeastSquares_ = false;
+        exactLeastSquares_ = false;
       }
       else if (value == "LSAPPROX")
       {
         useLeastSquares_ = true;
+        exactLeastSquares_ = false;
+      }
+      else if (value == "LS")
+      {
+        useLeastSquares_ = true;
+        exactLeastSquares_ = true;
       }
       else
       {
         return false;
       }
     }
+    else if (name == "SOLVER")
+    {
+      solverName_ = value;
+    }
+    else if (name == "THREADS")
+    {
+      if (!StringToULong(value, threads_)) return false;
+    }
+    else if (name == "TIME LIMIT")
+    {
+      if (!StringToDouble(value, timeLimit_) || timeLimit_ < 0) return false;
+    }
     else if (name == "MARKET INFO PROVIDER" || name == "PROVIDER")
     {
       providerName_ = value;
@@ -330,6 +419,109 @@ bool Allocation::LoadHandler(LoadContext &ctx, std::string section, std::string
       return false;
     }
   }
+  else if (section == "SOLVER")
+  {
+    MIPSolver::Options &o = solverOptions_;
+    if (name == "BRANCHING")
+    {
+      if (value == "FFV") o.branching = MIPSolver::Options::firstFractional;
+        else if (value == "LFV") o.branching = MIPSolver::Options::lastFractional;
+          else if (value == "MFV") o.branching = MIPSolver::Options::mostFractional;
+            else if (value == "DTH") o.branching = MIPSolver::Options::driebeckTomlin;
+              else if (value == "PCH") o.branching = MIPSolver::Options::pseudoCost;
+                else return false;
+    }
+    else if (name == "BACKTRACKING")
+    {
+      if (value == "DFS") o.backtracking = MIPSolver::Options::depthFirst;
+        else if (value == "BFS") o.backtracking = MIPSolver::Options::breadthFirst;
+          else if (value == "BLB") o.backtracking = MIPSolver::Options::bestLocalBound;
+            else if (value == "BPH") o.backtracking = MIPSolver::Options::bestProjection;
+              else return false;
+    }
+    else if (name == "PREPROCESSING")
+    {
+      if (value == "NONE") o.preprocessing = MIPSolver::Options::noPreprocessing;
+        else if (value == "ROOT") o.preprocessing = MIPSolver::Options::rootPreprocessing;
+          else if (value == "ALL") o.preprocessing = MIPSolver::Options::allPreprocessing;
+            else return false;
+    }
+    else if (name == "GOMORY CUTS")
+    {
+      if (!StringToBool(value, o.gomoryCuts)) return false;
+    }
+    else if (name == "MIR CUTS")
+    {
+      if (!StringToBool(value, o.mirCuts)) return false;
+    }
+    else if (name == "COVER CUTS")
+    {
+      if (!StringToBool(value, o.coverCuts)) return false;
+    }
+    else if (name == "CLIQUE CUTS")
+    {
+      if (!StringToBool(value, o.cliqueCuts)) return false;
+    }
+    else if (name == "MIP GAP")
+    {
+      bool percents;
+      if (!StringToDouble(value, o.mipGap, percents) || o.mipGap < 0) return false;
+      if (percents) o.mipGap *= 0.01;
+    }
+    else if (name == "TIME LIMIT")
+    {
+      if (!StringToDouble(value, o.timeLimit) || o.timeLimit < 0) return false;
+    }
+    else if (name == "PRESOLVE")
+    {
+      if (!StringToBool(value, o.presolve)) return false;
+    }
+    else if (name == "BRANCHING PRIORITIES")
+    {
+      if (!StringToBool(value, o.priorities)) return false;
+    }
+    else if (name == "REDUCE MODEL")
+    {
+      if (!StringToBool(value, o.reduceModel)) return false;
+    }
+    else if (name == "SCALING")
+    {
+      if (!StringToScaling(value, o)) return false;
+    }
+    else if (name == "ENCODING")
+    {
+      if (value == "SEGMENTS") encoding_ = MIPSolver::segmentEncoding;
+        else if (value == "LOGARITHMIC" || value == "LOG") encoding_ = MIPSolver::logarithmicEncoding;
+          else if (value == "CONVEX") encoding_ = MIPSolver::convexEncoding;
+            else return false;
+    }
+    else if (name == "REFPOINT TOLERANCE")
+    {
+      if (!StringToDouble(value, refPointTolerance_) || refPointTolerance_ < 0) return false;
+    }
+    else if (name == "RELATIVE REFPOINT TOLERANCE")
+    {
+      bool percents;
+      if (!StringToDouble(value, relativeRefPointTolerance_, percents) || relativeRefPointTolerance_ < 0) return false;
+      if (percents) relativeRefPointTolerance_ *= 0.01;
+    }
+    else if (name == "MAX ITERATIONS")
+    {
+      if (!StringToULong(value, maxIterations_)) return false;
+    }
+    else if (name == "MULTISCALE REFPOINTS")
+    {
+      if (!StringToBool(value, multiscaleRefPoints_)) return false;
+    }
+    else if (name == "ROUNDING HEURISTIC")
+    {
+      if (!StringToBool(value, roundingHeuristic_)) return false;
+    }
+    else
+    {
+      return false;
+    }
+  }
   else
   {
     return false;
@@ -372,6 +564,33 @@ bool Allocation::StringToULong(const std::string &s, size_t &n)
   return !*end;
 }
 
+bool Allocation::StringToScaling(const std::string &s, MIPSolver::Options &options)
+{
+  options.scaleGeometric = false;
+  options.scaleEquilibrate = false;
+  options.scaleRoundToPowerOf2 = false;
+  options.scaleSkipIfWellScaled = false;
+  options.scaleAuto = false;
+
+  // A list of GLPK scaling flags, e.g. "GM, EQ, 2N"
+  std::stringstream ss(s);
+  std::string flag;
+  while (std::getline(ss, flag, ','))
+  {
+    flag.erase(0, flag.find_first_not_of(" \t"));
+    flag.erase(flag.find_last_not_of(" \t") + 1);
+
+    if (flag == "GM") options.scaleGeometric = true;
+      else if (flag == "EQ") options.scaleEquilibrate = true;
+        else if (flag == "2N") options.scaleRoundToPowerOf2 = true;
+          else if (flag == "SKIP") options.scaleSkipIfWellScaled = true;
+            else if (flag == "AUTO") options.scaleAuto = true;
+              else if (flag != "NONE" && !flag.empty()) return false;
+  }
+
+  return true;
+}
+
 Allocation::Asset &Allocation::GetAsset(const std::string &ticker, bool create)
 {
   for (size_t i = 0; i < assets_.size(); i++)
@@ -22,6 +22,8 @@
 
 #pragma once
 
+#include "mipsolver.h"
+
 #include <istream>
 #include <string>
 #include <vector>
@@ -49,8 +51,26 @@ public:
 
   bool UseAllCash() const;
   size_t GetMaxDeals() const;
+  size_t GetAlternatives() const; // Other plans with different deals, besides the best one
 
   bool UseLeastSquaresApproximation() const;
+  bool UseExactLeastSquares() const; // Instead of the approximation
+  const std::string &GetSolverName() const;
+  size_t GetThreads() const;
+  double GetTimeLimit() const;
+  const MIPSolver::Options &GetSolverOptions() const;
+  MIPSolver::Encoding GetEncoding() const;
+
+  // Refinement of the least squares approximation: deviations that meet refpoints within the tolerances
+  // (see MIPSolver::RefPoints) end it,
+  // as does the iteration limit (zero means none); multiscale refpoints are seeded around the targets first
+  double GetRefPointTolerance() const;
+  double GetRelativeRefPointTolerance() const;
+  size_t GetMaxIterations() const;
+  bool UseMultiscaleRefPoints() const;
+
+  // Relaxed deals are rounded to plans during the search
+  bool UseRoundingHeuristic() const;
   const std::string &GetProviderName() const;
   const std::string &GetProviderToken() const;
 
@@ -72,6 +92,7 @@ private:
   static bool StringToDouble(const std::string &s, double &d);
   static bool StringToBool(const std::string &s, bool &b);
   static bool StringToULong(const std::string &s, size_t &n);
+  static bool StringToScaling(const std::string &s, MIPSolver::Options &options);
 
   struct Asset;
   Asset &GetAsset(const std::string &ticker, bool create = false);
@@ -100,8 +121,20 @@ private:
 
   bool noMoreDeals_  = false;
   size_t maxDeals_   = 0;
+  size_t alternatives_ = 0;
 
   bool useLeastSquares_ = true;
+  bool exactLeastSquares_ = false;
+  std::string solverName_ = "GLPK";
+  size_t threads_ = 1;
+  double timeLimit_ = 0; // Seconds, zero means no limit
+  MIPSolver::Options solverOptions_;
+  MIPSolver::Encoding encoding_ = MIPSolver::segmentEncoding;
+  double refPointTolerance_ = 0.5;
+  double relativeRefPointTolerance_ = 0;
+  size_t maxIterations_ = 0;
+  bool multiscaleRefPoints_ = false;
+  bool roundingHeuristic_ = false;
   std::string providerName_ = "YAHOO FINANCE";
   std::string providerToken_;
 };
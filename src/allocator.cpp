@@ -22,12 +22,14 @@
 
 #include "alphavantage.h"
 #include "curl.h"
+#include "mipengine.h"
 #include "optimizer.h"
 #include "tableformatter.h"
 #include "yahoofinance.h"
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <ctime>
 #include <iomanip>
 #include <iostream>
@@ -40,6 +42,8 @@ int main(int argc, char* argv[])
 {
   std::string config;
   std::string proxy;
+  std::string dumpDirectory;
+  bool statistics = false;
 
   // Parse command line
   for (int i = 1; i < argc; i++)
@@ -58,12 +62,26 @@ int main(int argc, char* argv[])
     {
       std::cout << std::endl;
       std::cout << "Usage:" << std::endl;
-      std::cout << "  " << argv[0] << " <config> [<proxy>]" << std::endl;
+      std::cout << "  " << argv[0] << " [--statistics] [--dump-models <directory>] <config> [<proxy>]" << std::endl;
     }
 
     if (v || h) return 0;
 
-    if (config.empty())
+    if (arg == "--statistics")
+    {
+      statistics = true;
+    }
+    else if (arg == "--dump-models")
+    {
+      if (++i == argc)
+      {
+        std::cout << "Error: Directory for models was not specified" << std::endl;
+        return 1;
+      }
+      dumpDirectory = argv[i];
+      std::cout << "Models: " << dumpDirectory << std::endl;
+    }
+    else if (config.empty())
     {
       config = arg;
       std::cout << "Config: " << config << std::endl;
@@ -94,7 +112,15 @@ int main(int argc, char* argv[])
   }
 
   std::cout << "Model: Least "
-    << (a.UseLeastSquaresApproximation() ? "Squares Approximation" : "Absolute Deviations") << std::endl;
+    << (a.UseLeastSquaresApproximation() ? (a.UseExactLeastSquares() ? "Squares" : "Squares Approximation")
+      : "Absolute Deviations") << std::endl;
+
+  if (!MIPSolver::CreateEngine(a.GetSolverName()))
+  {
+    std::cout << "Error: Unknown solver: " << a.GetSolverName() << std::endl;
+    return 1;
+  }
+  std::cout << "Solver: " << a.GetSolverName() << std::endl;
 
   MarketInfoProvider::Tickers tickers(a.GetCount());
   for (size_t i = 0; i < a.GetCount(); i++)
@@ -228,9 +254,56 @@ int main(int argc, char* argv[])
     }
   );
 
+  o.SetModelDump(dumpDirectory);
   o.Optimize(a, ratesProvider);
   std::cout << std::string(maxStatusLength, ' ') << std::endl;
 
+  const std::vector<MIPSolver::Statistics> &steps = o.GetStatistics();
+  if (std::any_of(steps.begin(), steps.end(), [](const MIPSolver::Statistics &st) { return st.dumpFailed; }))
+  {
+    std::cout << "Warning: Some models could not be written to " << dumpDirectory << std::endl;
+  }
+
+  if (!o.IsOptimal())
+  {
+    std::cout << "Warning: The result is not proven to be optimal";
+    if (o.GetTermination() == MIPSolver::timeout)
+    {
+      std::cout << ", the time limit has been reached";
+    }
+    else if (o.GetTermination() == MIPSolver::interrupted)
+    {
+      std::cout << ", the optimization has been interrupted";
+    }
+    if (!std::isinf(o.GetGap())) std::cout << " (gap " << o.GetGap() * 100 << "%)";
+    std::cout << std::endl;
+  }
+
+  if (statistics)
+  {
+    const std::vector<MIPSolver::Statistics> &stats = o.GetStatistics();
+    for (size_t i = 0; i < stats.size(); i++)
+    {
+      const MIPSolver::Statistics &st = stats[i];
+      std::cout << "Step " << i + 1 << ": " << std::fixed << std::setprecision(3)
+        << "build " << st.buildTime << "s, upload " << st.uploadTime << "s, LP " << st.lpTime
+        << "s, search " << st.searchTime << "s; " << st.nodes << " nodes, " << st.lpIterations << " LP iterations, "
+        << st.cuts << " cuts; " << st.variables << " variables, " << st.conditions << " conditions, "
+        << st.nonzeros << " nonzeros" << std::endl;
+    }
+
+    const std::vector<Optimizer::Convergence> &convergence = o.GetConvergence();
+    for (size_t i = 0; i < convergence.size(); i++)
+    {
+      const Optimizer::Convergence &c = convergence[i];
+      std::cout << "Iteration " << i + 1 << ": " << std::fixed << std::setprecision(3)
+        << "approximation " << c.approximation << ", exact " << c.exact << ", difference " << c.exact - c.approximation
+        << "; " << c.refpoints << " refpoints, " << c.added << " added" << std::endl;
+    }
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+  }
+
   struct Result : public Optimizer::Result
   {
     bool isCash;
@@ -559,5 +632,30 @@ int main(int argc, char* argv[])
     std::cout << std::endl;
   }
 
+  for (size_t k = 0; k < o.GetAlternativeCount(); k++)
+  {
+    if (k == 0)
+    {
+      std::cout << std::endl;
+      std::cout << "Alternatives:" << std::endl;
+    }
+
+    std::cout << "  " << k + 1 << ". Deviation " << std::fixed << std::setprecision(1)
+      << o.GetAlternativeQuality(k).stddev << ":";
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+
+    bool any = false;
+    for (size_t i = 0; i < a.GetCount(); i++)
+    {
+      const Optimizer::Result &r = o.GetAlternativeResult(k, a.GetTicker(i));
+      if (r.change == 0) continue;
+
+      std::cout << (any ? ", " : " ") << (r.change > 0 ? "buy " : "sell ") << fabs(r.change) << " " << r.ticker;
+      any = true;
+    }
+    std::cout << (any ? "" : " no deals") << std::endl;
+  }
+
   return 0;
 }
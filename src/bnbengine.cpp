@@ -0,0 +1,540 @@
+// MIT License
+//
+// Copyright (c) 2019 Ivan Kelarev
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "bnbengine.h"
+#include "glpkengine.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <glpk.h>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+  const double IntegralityTolerance = 1e-6;
+
+  double GetPruneTolerance(double value)
+  {
+    return 1e-7 * (1 + fabs(value));
+  }
+
+  // GLPK reports missing bounds as -DBL_MAX and +DBL_MAX, these are infinite like the ones of the variables
+  double GetLowerBound(glp_prob *lp, int col)
+  {
+    int type = glp_get_col_type(lp, col);
+    return type == GLP_FR || type == GLP_UP ? -std::numeric_limits<double>::infinity() : glp_get_col_lb(lp, col);
+  }
+
+  double GetUpperBound(glp_prob *lp, int col)
+  {
+    int type = glp_get_col_type(lp, col);
+    return type == GLP_FR || type == GLP_LO ? std::numeric_limits<double>::infinity() : glp_get_col_ub(lp, col);
+  }
+}
+
+struct BnbEngine::Search
+{
+  struct Worker
+  {
+    std::mutex mutex;
+    std::deque<Node> nodes;
+  };
+
+  const MIPSolver &s;
+  std::vector<double> objective; // 1-based as GLPK columns
+  double c;
+  std::vector<int> integers;
+  const Options &options;
+
+  std::vector<Worker> workers;
+  std::atomic<size_t> queued; // Nodes in the deques, idle workers wait for it to become positive
+  std::atomic<size_t> pending;
+  std::atomic<size_t> solved;
+  std::atomic<bool> stop;
+
+  // Statistics, the times are written by a single thread each and read after the workers are joined
+  std::atomic<size_t> iterations;
+  std::atomic<size_t> cuts;
+  double uploadTime;
+  double lpTime;
+
+  // The value is read without locking to prune nodes, the mutex guards updates of both members
+  std::mutex incumbentMutex;
+  std::atomic<double> incumbentValue;
+  Vector incumbent;
+
+  // The lowest bound of the nodes pruned only because of the relative gap of the options
+  // or left unexplored because their LP could not be solved (which also means no proof of optimality)
+  std::mutex gapMutex;
+  double gapBound;
+  std::atomic<bool> failed;
+
+  // Nodes with greater bounds cannot improve the incumbent enough
+  double GetCutoff(double best) const
+  {
+    return best - std::max(GetPruneTolerance(best), options.mipGap * fabs(best + c));
+  }
+
+  std::mutex doneMutex;
+  std::condition_variable done;
+
+  // Notified when a node is queued, the tree is explored or the search is stopped
+  std::mutex workMutex;
+  std::condition_variable work;
+
+  void Wake(bool all)
+  {
+    // Locking orders the notification after the check of a worker that is about to wait
+    {
+      std::lock_guard<std::mutex> lock(workMutex);
+    }
+    if (all)
+    {
+      work.notify_all();
+    }
+    else
+    {
+      work.notify_one();
+    }
+  }
+
+  Search(const MIPSolver &s, size_t threads)
+    : s(s), c(0), options(GetOptions(s)), workers(threads), queued(0), pending(0), solved(0), stop(false),
+      iterations(0), cuts(0), uploadTime(0), lpTime(0),
+      incumbentValue(std::numeric_limits<double>::infinity()), gapBound(std::numeric_limits<double>::infinity()),
+      failed(false)
+  {
+  }
+};
+
+std::unique_ptr<MIPSolver::Engine> BnbEngine::Clone() const
+{
+  return std::unique_ptr<Engine>(new BnbEngine());
+}
+
+void BnbEngine::Rollback(size_t, size_t)
+{
+  // The model is uploaded from scratch on every optimization
+}
+
+void BnbEngine::ChangeVariable(size_t)
+{
+  // Like rollbacks, changes are uploaded with the whole model
+}
+
+void BnbEngine::ChangeCondition(size_t)
+{
+}
+
+void BnbEngine::Minimize(const MIPSolver &s, const Expression &objective, const Vector &start, Outcome &outcome)
+{
+  const std::vector<VariableInfo> &vars = GetVariables(s);
+
+  size_t threads = GetThreads(s);
+  if (threads == 0)
+  {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  Search search(s, threads);
+
+  search.objective.assign(vars.size() + 1, 0);
+  const Expression::Factors &f = objective.GetFactors();
+  for (auto it = f.begin(); it != f.end(); it++)
+  {
+    assert(it->first < vars.size());
+    search.objective[it->first + 1] = it->second;
+  }
+  search.c = objective.GetC();
+
+  for (size_t i = 0; i < vars.size(); i++)
+  {
+    if (vars[i].type != MIPSolver::continuous && vars[i].min != vars[i].max)
+    {
+      search.integers.push_back(static_cast<int>(i + 1));
+    }
+  }
+
+  if (!start.empty())
+  {
+    assert(start.size() == vars.size());
+
+    double value = 0;
+    for (size_t i = 0; i < start.size(); i++)
+    {
+      value += search.objective[i + 1] * start[i];
+    }
+
+    search.incumbent = start;
+    search.incumbentValue = value;
+  }
+
+  Node root;
+  root.lp = -std::numeric_limits<double>::infinity();
+  search.queued = 1;
+  search.pending = 1;
+  search.workers[0].nodes.push_back(std::move(root));
+
+  std::vector<std::thread> pool;
+  for (size_t i = 0; i < threads; i++)
+  {
+    pool.push_back(std::thread(&BnbEngine::Work, std::ref(search), i));
+  }
+
+  // The status callback is user code, so it is called from the optimizing thread only
+  Clock::time_point deadline = GetDeadline(s, Clock::now());
+  {
+    std::unique_lock<std::mutex> lock(search.doneMutex);
+    while (search.pending > 0 && !search.stop)
+    {
+      Clock::time_point wakeup = Clock::now() + std::chrono::milliseconds(100);
+      if (search.done.wait_until(lock, std::min(wakeup, deadline),
+        [&search]() { return search.pending == 0; })) break;
+
+      if (Clock::now() >= deadline)
+      {
+        outcome.termination = MIPSolver::timeout;
+        break;
+      }
+
+      lock.unlock();
+
+      double progress = 0;
+      double best = search.incumbentValue;
+      if (!std::isinf(best))
+      {
+        progress = std::max(0.0, 1 - std::min(GetGap(best, GetBound(search)), 1.0));
+      }
+
+      if (!ReportStatus(s, static_cast<int>(search.pending), progress))
+      {
+        outcome.termination = MIPSolver::interrupted;
+        search.stop = true;
+      }
+      lock.lock();
+    }
+    search.stop = true;
+  }
+  search.Wake(true);
+
+  for (auto it = pool.begin(); it != pool.end(); it++)
+  {
+    it->join();
+  }
+
+  outcome.nodes = search.solved;
+  outcome.uploadTime = search.uploadTime;
+  outcome.lpTime = search.lpTime;
+  outcome.lpIterations = search.iterations;
+  outcome.cuts = search.cuts;
+  if (search.incumbent.empty())
+  {
+    return;
+  }
+
+  // All unexplored nodes are back in the deques after the workers have stopped, so the bound is exact
+  double c = objective.GetC();
+  double bound = std::min(GetBound(search), search.gapBound);
+  outcome.x = std::move(search.incumbent);
+  outcome.optimal = search.pending == 0 && !search.failed && std::isinf(search.gapBound);
+  outcome.gap = outcome.optimal ? 0 : GetGap(search.incumbentValue + c, bound + c);
+}
+
+void BnbEngine::Work(Search &search, size_t index)
+{
+  // This thread has its own GLPK environment, released when the thread exits
+  GlpkEngine::PrepareThread();
+
+  Clock::time_point uploading = Clock::now();
+
+  glp_prob *lp = glp_create_prob();
+  GlpkEngine::AppendModel(lp, search.s, 0, 0);
+
+  int scaling = GlpkEngine::GetScalingFlags(search.options);
+  if (scaling)
+  {
+    glp_scale_prob(lp, scaling);
+  }
+
+  // The threads upload in parallel, so the first one is as good as any
+  if (index == 0)
+  {
+    search.uploadTime = GetSeconds(uploading, Clock::now());
+  }
+
+  std::vector<int> touched;
+
+  Node node;
+  while (!search.stop)
+  {
+    if (!Pop(search, index, node))
+    {
+      std::unique_lock<std::mutex> lock(search.workMutex);
+      search.work.wait(lock, [&search]() { return search.queued > 0 || search.pending == 0 || search.stop; });
+      if (search.pending == 0) break;
+      continue;
+    }
+
+    Process(search, index, lp, touched, node);
+
+    // Children are already counted, so zero means that the whole tree has been explored
+    if (--search.pending == 0)
+    {
+      {
+        std::lock_guard<std::mutex> lock(search.doneMutex);
+        search.done.notify_all();
+      }
+      search.Wake(true);
+    }
+  }
+
+  glp_delete_prob(lp);
+}
+
+void BnbEngine::Process(Search &search, size_t index, glp_prob *lp, std::vector<int> &touched, const Node &node)
+{
+  double best = search.incumbentValue;
+  if (node.lp >= search.GetCutoff(best))
+  {
+    Prune(search, node.lp);
+    return;
+  }
+
+  const std::vector<VariableInfo> &vars = GetVariables(search.s);
+
+  // The problem keeps the bounds and the basis of the previous node, only the bounds are restored
+  for (auto it = touched.begin(); it != touched.end(); it++)
+  {
+    const VariableInfo &vi = vars[*it - 1];
+    GlpkEngine::SetColumn(lp, *it, vi.min, vi.max);
+  }
+  touched.clear();
+
+  for (auto it = node.bounds.begin(); it != node.bounds.end(); it++)
+  {
+    GlpkEngine::SetColumn(lp, it->col, it->min, it->max);
+    touched.push_back(it->col);
+  }
+
+  int cols = glp_get_num_cols(lp);
+  for (int col = 1; col <= cols; col++)
+  {
+    glp_set_obj_coef(lp, col, search.objective[col]);
+  }
+
+  glp_smcp smcp;
+  glp_init_smcp(&smcp);
+  smcp.msg_lev = GLP_MSG_OFF;
+  smcp.meth = GLP_DUALP;
+
+  int iterations = glp_get_it_cnt(lp);
+  Clock::time_point solving = Clock::now();
+
+  // Tangents of squares and lazy conditions are valid for all nodes, so they stay in the problem of this thread
+  int added = 0;
+  do
+  {
+    search.cuts += added;
+
+    if (glp_simplex(lp, &smcp) != 0)
+    {
+      // The basis may become invalid for the new bounds
+      glp_adv_basis(lp, 0);
+      if (glp_simplex(lp, &smcp) != 0)
+      {
+        // The subtree is given up, its bound is the one of the parent
+        search.solved++;
+        search.failed = true;
+        std::lock_guard<std::mutex> lock(search.gapMutex);
+        search.gapBound = std::min(search.gapBound, node.lp);
+        return;
+      }
+    }
+
+    if (glp_get_status(lp) != GLP_OPT)
+    {
+      search.solved++;
+      return;
+    }
+  }
+  while ((added = GlpkEngine::AddViolatedTangents(lp, search.s) + GlpkEngine::AddViolatedConditions(lp, search.s)) > 0);
+
+  search.solved++;
+  search.iterations += glp_get_it_cnt(lp) - iterations;
+
+  // Only the root has no bounds of its own
+  if (node.bounds.empty())
+  {
+    search.lpTime = GetSeconds(solving, Clock::now());
+  }
+
+  double value = glp_get_obj_val(lp);
+  best = search.incumbentValue;
+  if (value >= search.GetCutoff(best))
+  {
+    Prune(search, value);
+    return;
+  }
+
+  // Other branching rules of the options are replaced with the most fractional one,
+  // which is applied among the fractional variables of the highest priority
+  int col = 0;
+  double colValue = 0;
+  double distance = IntegralityTolerance;
+  int priority = 0;
+  for (auto it = search.integers.begin(); it != search.integers.end(); it++)
+  {
+    double v = glp_get_col_prim(lp, *it);
+    double d = fabs(v - floor(v + 0.5));
+    if (d <= IntegralityTolerance) continue;
+
+    int p = search.options.priorities ? vars[*it - 1].priority : 0;
+    if (col && p < priority) continue;
+
+    if (!col || p > priority || search.options.branching == MIPSolver::Options::lastFractional ||
+      (search.options.branching != MIPSolver::Options::firstFractional && d > distance))
+    {
+      col = *it;
+      colValue = v;
+      distance = d;
+      priority = p;
+    }
+  }
+
+  if (!col)
+  {
+    Vector x(cols);
+    for (int i = 1; i <= cols; i++)
+    {
+      x[i - 1] = glp_get_col_prim(lp, i);
+    }
+    for (auto it = search.integers.begin(); it != search.integers.end(); it++)
+    {
+      x[*it - 1] = floor(x[*it - 1] + 0.5);
+    }
+
+    std::lock_guard<std::mutex> lock(search.incumbentMutex);
+    if (value < search.incumbentValue - GetPruneTolerance(search.incumbentValue))
+    {
+      search.incumbent = std::move(x);
+      search.incumbentValue = value;
+    }
+    return;
+  }
+
+  Node down;
+  down.bounds = node.bounds;
+  down.bounds.push_back({ col, GetLowerBound(lp, col), floor(colValue) });
+  down.lp = value;
+
+  Node up;
+  up.bounds = node.bounds;
+  up.bounds.push_back({ col, ceil(colValue), GetUpperBound(lp, col) });
+  up.lp = value;
+
+  // The last pushed child is explored first
+  search.pending += 2;
+  if (colValue - floor(colValue) > 0.5)
+  {
+    Push(search, index, std::move(down));
+    Push(search, index, std::move(up));
+  }
+  else
+  {
+    Push(search, index, std::move(up));
+    Push(search, index, std::move(down));
+  }
+}
+
+void BnbEngine::Prune(Search &search, double bound)
+{
+  // Nodes that cannot improve the incumbent at all do not affect the gap
+  if (bound >= search.incumbentValue - GetPruneTolerance(search.incumbentValue)) return;
+
+  std::lock_guard<std::mutex> lock(search.gapMutex);
+  search.gapBound = std::min(search.gapBound, bound);
+}
+
+bool BnbEngine::Pop(Search &search, size_t index, Node &node)
+{
+  {
+    Search::Worker &w = search.workers[index];
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if (!w.nodes.empty())
+    {
+      node = std::move(w.nodes.back());
+      w.nodes.pop_back();
+      search.queued--;
+      return true;
+    }
+  }
+
+  // The oldest nodes are stolen since they are closer to the root and have bigger subtrees
+  for (size_t i = 1; i < search.workers.size(); i++)
+  {
+    Search::Worker &w = search.workers[(index + i) % search.workers.size()];
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if (!w.nodes.empty())
+    {
+      node = std::move(w.nodes.front());
+      w.nodes.pop_front();
+      search.queued--;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void BnbEngine::Push(Search &search, size_t index, Node &&node)
+{
+  {
+    Search::Worker &w = search.workers[index];
+    std::lock_guard<std::mutex> lock(w.mutex);
+    w.nodes.push_back(std::move(node));
+    search.queued++;
+  }
+  search.Wake(false);
+}
+
+double BnbEngine::GetBound(Search &search)
+{
+  // Nodes being processed are not counted, so the bound is approximate while the workers are running
+  double bound = search.incumbentValue;
+  for (auto it = search.workers.begin(); it != search.workers.end(); it++)
+  {
+    std::lock_guard<std::mutex> lock(it->mutex);
+    for (auto node = it->nodes.begin(); node != it->nodes.end(); node++)
+    {
+      bound = std::min(bound, node->lp);
+    }
+  }
+
+  return bound;
+}
@@ -0,0 +1,62 @@
+// MIT License
+//
+// Copyright (c) 2019 Ivan Kelarev
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "mipengine.h"
+
+struct glp_prob;
+
+// Branch and bound over the LP relaxations solved by GLPK, every thread keeps its own GLPK problem
+// and its own deque of nodes, idle threads steal the oldest nodes of the others.
+// Only the branching on fractional variables, the gap, the time limit and the scaling options are supported.
+class BnbEngine : public MIPSolver::Engine
+{
+public:
+  std::unique_ptr<Engine> Clone() const override;
+  void Rollback(size_t vars, size_t conds) override;
+  void ChangeVariable(size_t var) override;
+  void ChangeCondition(size_t cond) override;
+  void Minimize(const MIPSolver &s, const Expression &objective, const Vector &start, Outcome &outcome) override;
+
+private:
+  struct Bound
+  {
+    int col;
+    double min;
+    double max;
+  };
+
+  struct Node
+  {
+    std::vector<Bound> bounds; // Applied in order, so later ones override earlier ones
+    double lp;
+  };
+
+  struct Search;
+  static void Work(Search &search, size_t index);
+  static void Process(Search &search, size_t index, glp_prob *lp, std::vector<int> &touched, const Node &node);
+  static void Prune(Search &search, double bound);
+  static bool Pop(Search &search, size_t index, Node &node);
+  static void Push(Search &search, size_t index, Node &&node);
+  static double GetBound(Search &search);
+};
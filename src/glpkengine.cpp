@@ -0,0 +1,809 @@
+// MIT License
+//
+// Copyright (c) 2019 Ivan Kelarev
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "glpkengine.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cmath>
+#include <glpk.h>
+
+namespace
+{
+  std::atomic<unsigned long long> LastEnvironment(0);
+
+  // Zero until GLPK is prepared on the thread and after its environment is released
+  thread_local unsigned long long CurrentEnvironment = 0;
+
+  struct EnvironmentGuard
+  {
+    ~EnvironmentGuard()
+    {
+      glp_free_env();
+      CurrentEnvironment = 0;
+    }
+  };
+}
+
+template<class T>
+static void GlpkCallbackHelper(T *tree, void *param)
+{
+  assert(param);
+  reinterpret_cast<GlpkEngine *>(param)->Callback(tree);
+}
+
+static void GlpkCallbackHelper(glp_tree *tree, void *param)
+{
+  GlpkCallbackHelper<glp_tree>(tree, param);
+}
+
+static int GetColumnKind(MIPSolver::VariableType type)
+{
+  switch (type)
+  {
+    case MIPSolver::continuous: return GLP_CV;
+    case MIPSolver::integer:    return GLP_IV;
+    case MIPSolver::binary:     return GLP_BV;
+  }
+
+  assert(0);
+  return GLP_CV;
+}
+
+static int GetRowType(MIPSolver::Relation rel)
+{
+  switch (rel)
+  {
+    case MIPSolver::lessOrEqual:    return GLP_UP;
+    case MIPSolver::greaterOrEqual: return GLP_LO;
+    case MIPSolver::equal:          return GLP_FX;
+  }
+
+  assert(0);
+  return GLP_FX;
+}
+
+// The arrays are scratch space of the caller, GLPK arrays are 1-based
+void GlpkEngine::SetColumn(glp_prob *lp, int col, double minValue, double maxValue)
+{
+  if (minValue == maxValue)
+  {
+    glp_set_col_bnds(lp, col, GLP_FX, minValue, maxValue);
+  }
+  else if (std::isinf(minValue) || std::isinf(maxValue))
+  {
+    // Only models read from files have unbounded variables
+    int type = std::isinf(minValue) ? (std::isinf(maxValue) ? GLP_FR : GLP_UP) : GLP_LO;
+    glp_set_col_bnds(lp, col, type, minValue, maxValue);
+  }
+  else
+  {
+    glp_set_col_bnds(lp, col, GLP_DB, minValue, maxValue);
+  }
+}
+
+static void SetRow(glp_prob *lp, int row, const MIPSolver::Condition &cond, std::vector<int> &ind, std::vector<double> &val)
+{
+  const MIPSolver::Expression &expr = cond.GetExpression();
+  const MIPSolver::Expression::Factors &f = expr.GetFactors();
+
+  ind.resize(1);
+  val.resize(1);
+  for (auto it = f.begin(); it != f.end(); it++)
+  {
+    if (it->second == 0) continue;
+
+    ind.push_back(static_cast<int>(it->first + 1));
+    val.push_back(it->second);
+  }
+  glp_set_mat_row(lp, row, static_cast<int>(ind.size() - 1), &ind.front(), &val.front());
+
+  glp_set_row_bnds(lp, row, GetRowType(cond.GetRelation()), -expr.GetC(), -expr.GetC());
+}
+
+static int GetBranchingTechnique(MIPSolver::Options::Branching branching)
+{
+  switch (branching)
+  {
+    case MIPSolver::Options::firstFractional: return GLP_BR_FFV;
+    case MIPSolver::Options::lastFractional:  return GLP_BR_LFV;
+    case MIPSolver::Options::mostFractional:  return GLP_BR_MFV;
+    case MIPSolver::Options::driebeckTomlin:  return GLP_BR_DTH;
+    case MIPSolver::Options::pseudoCost:      return GLP_BR_PCH;
+  }
+
+  assert(0);
+  return GLP_BR_DTH;
+}
+
+static int GetBacktrackingTechnique(MIPSolver::Options::Backtracking backtracking)
+{
+  switch (backtracking)
+  {
+    case MIPSolver::Options::depthFirst:     return GLP_BT_DFS;
+    case MIPSolver::Options::breadthFirst:   return GLP_BT_BFS;
+    case MIPSolver::Options::bestLocalBound: return GLP_BT_BLB;
+    case MIPSolver::Options::bestProjection: return GLP_BT_BPH;
+  }
+
+  assert(0);
+  return GLP_BT_BLB;
+}
+
+static int GetPreprocessingTechnique(MIPSolver::Options::Preprocessing preprocessing)
+{
+  switch (preprocessing)
+  {
+    case MIPSolver::Options::noPreprocessing:   return GLP_PP_NONE;
+    case MIPSolver::Options::rootPreprocessing: return GLP_PP_ROOT;
+    case MIPSolver::Options::allPreprocessing:  return GLP_PP_ALL;
+  }
+
+  assert(0);
+  return GLP_PP_ROOT;
+}
+
+int GlpkEngine::GetScalingFlags(const Options &options)
+{
+  int flags = 0;
+  if (options.scaleGeometric)        flags |= GLP_SF_GM;
+  if (options.scaleEquilibrate)      flags |= GLP_SF_EQ;
+  if (options.scaleRoundToPowerOf2)  flags |= GLP_SF_2N;
+  if (options.scaleSkipIfWellScaled) flags |= GLP_SF_SKIP;
+  if (options.scaleAuto)             flags |= GLP_SF_AUTO;
+  return flags;
+}
+
+unsigned long long GlpkEngine::PrepareThread()
+{
+  if (!CurrentEnvironment)
+  {
+    thread_local EnvironmentGuard guard;
+    (void)guard;
+
+    glp_term_out(GLP_OFF);
+    CurrentEnvironment = ++LastEnvironment;
+  }
+  return CurrentEnvironment;
+}
+
+GlpkEngine::~GlpkEngine()
+{
+  // A problem of another thread is released with the environment of that thread
+  if (lp_ && environment_ == CurrentEnvironment)
+  {
+    glp_delete_prob(lp_);
+  }
+}
+
+void GlpkEngine::Adopt()
+{
+  unsigned long long environment = PrepareThread();
+
+  // The problem of another thread cannot be touched here, so it is left to that thread and uploaded again
+  if (lp_ && environment_ != environment)
+  {
+    lp_ = nullptr;
+    uploadedVars_ = 0;
+    uploadedConds_ = 0;
+    changedVars_.clear();
+    changedConds_.clear();
+    objective_.clear();
+    scaled_ = false;
+  }
+}
+
+std::unique_ptr<MIPSolver::Engine> GlpkEngine::Clone() const
+{
+  return std::unique_ptr<Engine>(new GlpkEngine());
+}
+
+void GlpkEngine::Rollback(size_t vars, size_t conds)
+{
+  Adopt();
+
+  if (lp_ && uploadedConds_ > conds)
+  {
+    std::vector<int> num(1);
+    for (size_t i = conds; i < uploadedConds_; i++)
+    {
+      num.push_back(static_cast<int>(i + 1));
+    }
+    glp_del_rows(lp_, static_cast<int>(num.size() - 1), &num.front());
+    uploadedConds_ = conds;
+  }
+
+  if (lp_ && uploadedVars_ > vars)
+  {
+    std::vector<int> num(1);
+    for (size_t i = vars; i < uploadedVars_; i++)
+    {
+      num.push_back(static_cast<int>(i + 1));
+    }
+    glp_del_cols(lp_, static_cast<int>(num.size() - 1), &num.front());
+    uploadedVars_ = vars;
+
+    objective_.erase(
+      std::remove_if(objective_.begin(), objective_.end(), [vars](int col) { return col > static_cast<int>(vars); }),
+      objective_.end());
+  }
+}
+
+void GlpkEngine::ChangeVariable(size_t var)
+{
+  // Variables not uploaded yet are appended as they are now
+  if (var < uploadedVars_)
+  {
+    changedVars_.insert(var);
+  }
+}
+
+void GlpkEngine::ChangeCondition(size_t cond)
+{
+  if (cond < uploadedConds_)
+  {
+    changedConds_.insert(cond);
+  }
+}
+
+void GlpkEngine::Minimize(const MIPSolver &s, const Expression &objective, const Vector &start, Outcome &outcome)
+{
+  Clock::time_point uploading = Clock::now();
+  Upload(s);
+
+  const std::vector<VariableInfo> &vars = GetVariables(s);
+
+  // Reset the objective of the previous call
+  for (size_t i = 0; i < objective_.size(); i++)
+  {
+    glp_set_obj_coef(lp_, objective_[i], 0);
+  }
+  objective_.clear();
+
+  const Expression::Factors &f = objective.GetFactors();
+  for (auto it = f.begin(); it != f.end(); it++)
+  {
+    assert(it->first < vars.size());
+    int col = static_cast<int>(it->first + 1);
+    glp_set_obj_coef(lp_, col, it->second);
+    objective_.push_back(col);
+  }
+
+  // The constant term does not change the solution, but it is needed for the gap
+  glp_set_obj_coef(lp_, 0, objective.GetC());
+
+  const Options &options = GetOptions(s);
+
+  glp_iocp iocp;
+  glp_init_iocp(&iocp);
+  iocp.msg_lev  = GLP_MSG_OFF;
+  iocp.br_tech  = GetBranchingTechnique(options.branching);
+  iocp.bt_tech  = GetBacktrackingTechnique(options.backtracking);
+  iocp.pp_tech  = GetPreprocessingTechnique(options.preprocessing);
+  iocp.mir_cuts = options.mirCuts    ? GLP_ON : GLP_OFF;
+  iocp.gmi_cuts = options.gomoryCuts ? GLP_ON : GLP_OFF;
+  iocp.cov_cuts = options.coverCuts  ? GLP_ON : GLP_OFF;
+  iocp.clq_cuts = options.cliqueCuts ? GLP_ON : GLP_OFF;
+  iocp.mip_gap  = options.mipGap;
+  iocp.presolve = options.presolve   ? GLP_ON : GLP_OFF;
+
+  int scaling = GetScalingFlags(options);
+  if (scaling)
+  {
+    glp_scale_prob(lp_, scaling);
+    scaled_ = true;
+  }
+  else if (scaled_)
+  {
+    glp_unscale_prob(lp_);
+    scaled_ = false;
+  }
+
+  outcome.uploadTime = GetSeconds(uploading, Clock::now());
+
+  prioritized_ = false;
+  if (options.priorities)
+  {
+    for (size_t i = 1; i < vars.size() && !prioritized_; i++)
+    {
+      prioritized_ = vars[i].priority != vars[0].priority;
+    }
+  }
+
+  // The MIP presolver renumbers columns, so a starting incumbent, tangents of squares, lazy conditions,
+  // a heuristic or branching priorities require the original problem
+  if (!GetSquares(s).empty() || !GetLazyConditions(s).empty() || HasHeuristic(s) || prioritized_)
+  {
+    iocp.presolve = GLP_OFF;
+  }
+
+  incumbent_.clear();
+  if (!start.empty())
+  {
+    assert(start.size() == vars.size());
+    incumbent_.resize(start.size() + 1);
+    std::copy(start.begin(), start.end(), incumbent_.begin() + 1);
+    iocp.presolve = GLP_OFF;
+  }
+
+  deadline_ = GetDeadline(s, Clock::now());
+  iocp.tm_lim = GetTimeLimit(deadline_);
+
+  solver_ = &s;
+  gap_ = INFINITY;
+  nodes_ = 0;
+  cuts_ = 0;
+  lpTime_ = -1;
+  termination_ = MIPSolver::finished;
+  iocp.cb_func = &GlpkCallbackHelper;
+  iocp.cb_info = this;
+
+  // Iterations of the search on a presolved copy of the problem are not counted
+  int iterations = glp_get_it_cnt(lp_);
+  searchStarted_ = Clock::now();
+
+  bool ready = true;
+  if (iocp.presolve == GLP_OFF)
+  {
+    glp_smcp smcp;
+    glp_init_smcp(&smcp);
+    smcp.msg_lev = GLP_MSG_OFF;
+    smcp.tm_lim = GetTimeLimit(deadline_);
+
+    // The basis left by the previous optimization is the best guess, unless rollback has broken it
+    int ret = glp_simplex(lp_, &smcp);
+    if (ret != 0)
+    {
+      glp_adv_basis(lp_, 0);
+      ret = glp_simplex(lp_, &smcp);
+    }
+    ready = ret == 0 && glp_get_status(lp_) == GLP_OPT;
+    lpTime_ = GetSeconds(searchStarted_, Clock::now());
+
+    if (ret == GLP_ETMLIM)
+    {
+      termination_ = MIPSolver::timeout;
+    }
+  }
+
+  int ret = ready ? glp_intopt(lp_, &iocp) : GLP_EFAIL;
+  if (ret == GLP_ETMLIM)
+  {
+    termination_ = MIPSolver::timeout;
+  }
+
+  outcome.lpTime = std::max(lpTime_, 0.0);
+  outcome.lpIterations = static_cast<size_t>(std::max(glp_get_it_cnt(lp_) - iterations, 0));
+  outcome.cuts = cuts_;
+
+  // Tangents and lazy conditions added during the search should have been removed with the tree, but the model must stay in sync
+  int rows = glp_get_num_rows(lp_);
+  if (rows > static_cast<int>(uploadedConds_))
+  {
+    std::vector<int> num(1);
+    for (int row = static_cast<int>(uploadedConds_) + 1; row <= rows; row++)
+    {
+      num.push_back(row);
+    }
+    glp_del_rows(lp_, static_cast<int>(num.size() - 1), &num.front());
+  }
+
+  // The incumbent of a stopped search (or the one within the relative gap) is feasible, though not proven to be optimal
+  bool stopped = ret == GLP_ETMLIM || ret == GLP_ESTOP || ret == GLP_EMIPGAP;
+  int status = ret == 0 || stopped ? glp_mip_status(lp_) : GLP_UNDEF;
+  if (status == GLP_OPT || status == GLP_FEAS)
+  {
+    outcome.x.resize(vars.size());
+    for (size_t i = 0; i < vars.size(); i++)
+    {
+      outcome.x[i] = glp_mip_col_val(lp_, static_cast<int>(i + 1));
+    }
+    outcome.optimal = ret == 0 && status == GLP_OPT;
+    outcome.gap = outcome.optimal ? 0 : gap_;
+  }
+  outcome.termination = termination_;
+  outcome.nodes = nodes_;
+
+  solver_ = nullptr;
+  incumbent_.clear();
+}
+
+int GlpkEngine::GetTimeLimit(Clock::time_point deadline)
+{
+  if (deadline == Clock::time_point::max())
+  {
+    return INT_MAX;
+  }
+
+  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+
+  // GLPK treats zero as no time at all, which is what an expired deadline means
+  return static_cast<int>(std::max<decltype(left)>(0, std::min<decltype(left)>(left, INT_MAX)));
+}
+
+void GlpkEngine::Upload(const MIPSolver &s)
+{
+  Adopt();
+
+  if (!lp_)
+  {
+    lp_ = glp_create_prob();
+    environment_ = CurrentEnvironment;
+    uploadedVars_ = 0;
+    uploadedConds_ = 0;
+  }
+
+  // The changed columns and rows keep their places, so the basis of the previous optimization stays usable
+  const std::vector<VariableInfo> &vars = GetVariables(s);
+  for (auto it = changedVars_.begin(); it != changedVars_.end() && *it < uploadedVars_; it++)
+  {
+    SetColumn(lp_, static_cast<int>(*it + 1), vars[*it].min, vars[*it].max);
+  }
+  changedVars_.clear();
+
+  std::vector<int> ind(1);
+  std::vector<double> val(1);
+  const std::vector<Condition> &conds = GetConditions(s);
+  for (auto it = changedConds_.begin(); it != changedConds_.end() && *it < uploadedConds_; it++)
+  {
+    SetRow(lp_, static_cast<int>(*it + 1), conds[*it], ind, val);
+  }
+  changedConds_.clear();
+
+  AppendModel(lp_, s, uploadedVars_, uploadedConds_);
+
+  uploadedVars_ = GetVariables(s).size();
+  uploadedConds_ = GetConditions(s).size();
+}
+
+void GlpkEngine::AppendModel(glp_prob *lp, const MIPSolver &s, size_t firstVar, size_t firstCond)
+{
+  const std::vector<VariableInfo> &vars = GetVariables(s);
+  const std::vector<Condition> &conds = GetConditions(s);
+
+  assert(firstVar <= vars.size());
+  assert(firstCond <= conds.size());
+  assert(glp_get_num_cols(lp) == static_cast<int>(firstVar));
+  assert(glp_get_num_rows(lp) == static_cast<int>(firstCond));
+
+  if (firstVar < vars.size())
+  {
+    glp_add_cols(lp, static_cast<int>(vars.size() - firstVar));
+  }
+
+  for (size_t i = firstVar; i < vars.size(); i++)
+  {
+    int col = static_cast<int>(i + 1);
+
+    const VariableInfo &vi = vars[i];
+    glp_set_col_kind(lp, col, GetColumnKind(vi.type));
+    SetColumn(lp, col, vi.min, vi.max);
+  }
+
+  if (firstCond < conds.size())
+  {
+    glp_add_rows(lp, static_cast<int>(conds.size() - firstCond));
+  }
+
+  // Only nonzeros are uploaded, so the cost is linear in their number (GLPK arrays are 1-based)
+  std::vector<int> ind(1);
+  std::vector<double> val(1);
+
+  for (size_t i = firstCond; i < conds.size(); i++)
+  {
+    SetRow(lp, static_cast<int>(i + 1), conds[i], ind, val);
+  }
+}
+
+bool GlpkEngine::WriteModel(const MIPSolver &s, const Expression &objective, const std::string &file)
+{
+  PrepareThread();
+
+  glp_prob *lp = glp_create_prob();
+  AppendModel(lp, s, 0, 0);
+
+  // Lazy conditions are ordinary rows for other solvers
+  std::vector<int> ind(1);
+  std::vector<double> val(1);
+  const std::vector<Condition> &lazy = GetLazyConditions(s);
+  for (auto it = lazy.begin(); it != lazy.end(); it++)
+  {
+    SetRow(lp, glp_add_rows(lp, 1), *it, ind, val);
+  }
+
+  const Expression::Factors &f = objective.GetFactors();
+  for (auto it = f.begin(); it != f.end(); it++)
+  {
+    glp_set_obj_coef(lp, static_cast<int>(it->first + 1), it->second);
+  }
+  glp_set_obj_coef(lp, 0, objective.GetC());
+
+  bool ok = glp_write_mps(lp, GLP_MPS_FILE, nullptr, file.c_str()) == 0;
+  glp_delete_prob(lp);
+  return ok;
+}
+
+bool GlpkEngine::ReadModel(const std::string &file, MIPSolver &s, Expression &objective)
+{
+  PrepareThread();
+
+  glp_prob *lp = glp_create_prob();
+  if (glp_read_mps(lp, GLP_MPS_FILE, nullptr, file.c_str()) != 0)
+  {
+    glp_delete_prob(lp);
+    return false;
+  }
+
+  int cols = glp_get_num_cols(lp);
+  std::vector<Variable> x(1);
+  for (int col = 1; col <= cols; col++)
+  {
+    int kind = glp_get_col_kind(lp, col);
+    VariableType type = kind == GLP_BV ? MIPSolver::binary : kind == GLP_IV ? MIPSolver::integer : MIPSolver::continuous;
+
+    int bounds = glp_get_col_type(lp, col);
+    double lb = bounds == GLP_FR || bounds == GLP_UP ? -INFINITY : glp_get_col_lb(lp, col);
+    double ub = bounds == GLP_FR || bounds == GLP_LO ?  INFINITY : glp_get_col_ub(lp, col);
+    x.push_back(CreateVariable(s, type, lb, ub));
+  }
+
+  objective = glp_get_obj_coef(lp, 0);
+  for (int col = 1; col <= cols; col++)
+  {
+    double k = glp_get_obj_coef(lp, col);
+    if (k != 0) objective += k * x[col];
+  }
+  if (glp_get_obj_dir(lp) == GLP_MAX)
+  {
+    objective *= -1;
+  }
+
+  std::vector<int> ind(cols + 1);
+  std::vector<double> val(cols + 1);
+
+  int rows = glp_get_num_rows(lp);
+  for (int row = 1; row <= rows; row++)
+  {
+    Expression expr;
+    int len = glp_get_mat_row(lp, row, &ind.front(), &val.front());
+    for (int i = 1; i <= len; i++)
+    {
+      expr += val[i] * x[ind[i]];
+    }
+
+    double lb = glp_get_row_lb(lp, row);
+    double ub = glp_get_row_ub(lp, row);
+    switch (glp_get_row_type(lp, row))
+    {
+      case GLP_LO: AddCondition(s, expr >= lb); break;
+      case GLP_UP: AddCondition(s, expr <= ub); break;
+      case GLP_FX: AddCondition(s, expr == lb); break;
+      case GLP_DB: AddCondition(s, expr >= lb); AddCondition(s, expr <= ub); break;
+      default: break; // Free rows (like other objectives) do not restrict anything
+    }
+  }
+
+  glp_delete_prob(lp);
+  return true;
+}
+
+int GlpkEngine::AddViolatedTangents(glp_prob *lp, const MIPSolver &s)
+{
+  const double tolerance = 1e-6;
+
+  std::vector<int> ind(1);
+  std::vector<double> val(1);
+
+  int added = 0;
+  const std::vector<Square> &squares = GetSquares(s);
+  for (auto it = squares.begin(); it != squares.end(); it++)
+  {
+    double v = it->c;
+    for (auto f = it->factors.begin(); f != it->factors.end(); f++)
+    {
+      v += f->second * glp_get_col_prim(lp, static_cast<int>(f->first + 1));
+    }
+
+    double y = glp_get_col_prim(lp, static_cast<int>(it->var + 1));
+    if (y >= v * v - tolerance * (1 + v * v)) continue;
+
+    // The tangent at the current point: y >= 2 * v * (expr + c) - v * v
+    ind.resize(1);
+    val.resize(1);
+    ind.push_back(static_cast<int>(it->var + 1));
+    val.push_back(1);
+    for (auto f = it->factors.begin(); f != it->factors.end(); f++)
+    {
+      double a = -2 * v * f->second;
+      if (a == 0) continue;
+
+      ind.push_back(static_cast<int>(f->first + 1));
+      val.push_back(a);
+    }
+
+    int row = glp_add_rows(lp, 1);
+    glp_set_mat_row(lp, row, static_cast<int>(ind.size() - 1), &ind.front(), &val.front());
+    glp_set_row_bnds(lp, row, GLP_LO, 2 * v * it->c - v * v, 0);
+    added++;
+  }
+
+  return added;
+}
+
+int GlpkEngine::AddViolatedConditions(glp_prob *lp, const MIPSolver &s)
+{
+  const std::vector<Condition> &lazy = GetLazyConditions(s);
+  if (lazy.empty())
+  {
+    return 0;
+  }
+
+  int cols = glp_get_num_cols(lp);
+  Vector x(cols);
+  for (int col = 1; col <= cols; col++)
+  {
+    x[col - 1] = glp_get_col_prim(lp, col);
+  }
+
+  std::vector<int> ind(1);
+  std::vector<double> val(1);
+
+  int added = 0;
+  for (auto it = lazy.begin(); it != lazy.end(); it++)
+  {
+    if (IsSatisfied(*it, x)) continue;
+
+    SetRow(lp, glp_add_rows(lp, 1), *it, ind, val);
+    added++;
+  }
+
+  return added;
+}
+
+template<class T>
+void GlpkEngine::Callback(T *tree)
+{
+  int reason = glp_ios_reason(tree);
+
+  if (reason == GLP_IROWGEN)
+  {
+    // The first relaxation solved by the search is the root one, unless it has been solved before the search
+    if (lpTime_ < 0)
+    {
+      lpTime_ = GetSeconds(searchStarted_, Clock::now());
+    }
+
+    assert(solver_);
+    cuts_ += AddViolatedTangents(glp_ios_get_prob(tree), *solver_);
+    cuts_ += AddViolatedConditions(glp_ios_get_prob(tree), *solver_);
+  }
+
+  if (reason == GLP_IHEUR && !incumbent_.empty())
+  {
+    assert(static_cast<size_t>(glp_get_num_cols(glp_ios_get_prob(tree))) + 1 == incumbent_.size());
+    glp_ios_heur_sol(tree, &incumbent_.front());
+    incumbent_.clear();
+  }
+  else if (reason == GLP_IHEUR && HasHeuristic(*solver_))
+  {
+    glp_prob *lp = glp_ios_get_prob(tree);
+    int cols = glp_get_num_cols(lp);
+
+    Vector relaxation(cols);
+    for (int col = 1; col <= cols; col++)
+    {
+      relaxation[col - 1] = glp_get_col_prim(lp, col);
+    }
+
+    // GLPK ignores proposals which are not better than its incumbent
+    Vector x;
+    if (ProposeSolution(*solver_, relaxation, x))
+    {
+      x.insert(x.begin(), 0);
+      glp_ios_heur_sol(tree, &x.front());
+    }
+  }
+
+  if (reason == GLP_IBRANCH && prioritized_)
+  {
+    assert(solver_);
+    const std::vector<VariableInfo> &vars = GetVariables(*solver_);
+    const Options &options = GetOptions(*solver_);
+    glp_prob *lp = glp_ios_get_prob(tree);
+
+    // GLPK chooses by itself unless the candidates have different priorities, then the fractionality
+    // (or the order) decides among the ones of the highest priority
+    int col = 0;
+    int priority = 0;
+    double distance = 0;
+    bool mixed = false;
+    for (int j = 1; j <= static_cast<int>(vars.size()); j++)
+    {
+      if (!glp_ios_can_branch(tree, j)) continue;
+
+      int p = vars[j - 1].priority;
+      double v = glp_get_col_prim(lp, j);
+      double d = fabs(v - floor(v + 0.5));
+      if (!col || p > priority)
+      {
+        mixed = mixed || col;
+        col = j;
+        priority = p;
+        distance = d;
+      }
+      else if (p < priority)
+      {
+        mixed = true;
+      }
+      else if (options.branching == MIPSolver::Options::lastFractional ||
+        (options.branching != MIPSolver::Options::firstFractional && d > distance))
+      {
+        col = j;
+        distance = d;
+      }
+    }
+
+    if (mixed)
+    {
+      glp_ios_branch_upon(tree, col, GLP_NO_BRNCH);
+    }
+  }
+
+  if (reason == GLP_IPREPRO) // Once per subproblem
+  {
+    nodes_++;
+  }
+
+  if (reason == GLP_IBINGO)
+  {
+    gap_ = glp_ios_mip_gap(tree);
+  }
+
+  if (reason == GLP_ISELECT) // Do not do this too often
+  {
+    if (glp_mip_status(glp_ios_get_prob(tree)) != GLP_UNDEF)
+    {
+      gap_ = glp_ios_mip_gap(tree);
+    }
+
+    int a, n, t;
+    glp_ios_tree_size(tree, &a, &n, &t);
+
+    double gap = glp_ios_mip_gap(tree);
+    if (gap < 0) gap = 0;
+    if (gap > 1) gap = 1;
+
+    assert(solver_);
+    if (!ReportStatus(*solver_, a, 1 - gap))
+    {
+      termination_ = MIPSolver::interrupted;
+      glp_ios_terminate(tree);
+    }
+    else if (Clock::now() >= deadline_)
+    {
+      termination_ = MIPSolver::timeout;
+      glp_ios_terminate(tree);
+    }
+  }
+}
@@ -0,0 +1,105 @@
+// MIT License
+//
+// Copyright (c) 2019 Ivan Kelarev
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "mipengine.h"
+
+#include <set>
+#include <string>
+
+struct glp_prob;
+
+class GlpkEngine : public MIPSolver::Engine
+{
+public:
+  GlpkEngine() = default;
+  GlpkEngine(const GlpkEngine &) = delete;
+  ~GlpkEngine();
+
+  GlpkEngine &operator =(const GlpkEngine &) = delete;
+
+  std::unique_ptr<Engine> Clone() const override;
+  void Rollback(size_t vars, size_t conds) override;
+  void ChangeVariable(size_t var) override;
+  void ChangeCondition(size_t cond) override;
+  void Minimize(const MIPSolver &s, const Expression &objective, const Vector &start, Outcome &outcome) override;
+
+  // Appends the variables and conditions starting from the given ones to the problem
+  static void AppendModel(glp_prob *lp, const MIPSolver &s, size_t firstVar, size_t firstCond);
+
+  // Cuts off the current LP solution where it underestimates squares, returns the number of added rows
+  static int AddViolatedTangents(glp_prob *lp, const MIPSolver &s);
+
+  // Adds the lazy conditions violated by the current LP solution, returns the number of added rows
+  static int AddViolatedConditions(glp_prob *lp, const MIPSolver &s);
+
+  // Chooses the type of the column bounds, infinite values leave the column unbounded on their side
+  static void SetColumn(glp_prob *lp, int col, double minValue, double maxValue);
+
+  // Flags of glp_scale_prob, zero if the problem should not be scaled
+  static int GetScalingFlags(const Options &options);
+
+  // GLPK keeps its environment (terminal settings and memory of all problems) per thread, so every thread using it
+  // calls this first. The environment is released with all its problems when the thread exits. Returns its id.
+  static unsigned long long PrepareThread();
+
+  // The model with the objective in the free MPS format, which is what MIPSolver dumps
+  static bool WriteModel(const MIPSolver &s, const Expression &objective, const std::string &file);
+  static bool ReadModel(const std::string &file, MIPSolver &s, Expression &objective);
+
+private:
+  void Adopt();
+  void Upload(const MIPSolver &s);
+
+  template<class T>
+  void Callback(T *tree);
+
+private:
+  // The GLPK problem lives between optimizations and receives only the changes since the last one,
+  // as long as they happen on the thread whose environment it belongs to
+  glp_prob *lp_ = nullptr;
+  unsigned long long environment_ = 0;
+  size_t uploadedVars_ = 0;
+  size_t uploadedConds_ = 0;
+  std::set<size_t> changedVars_; // Uploaded ones to be updated, in the order of the problem
+  std::set<size_t> changedConds_;
+  std::vector<int> objective_;
+  bool scaled_ = false;
+
+  // Valid only during optimization
+  const MIPSolver *solver_ = nullptr;
+  Vector incumbent_;
+  Clock::time_point deadline_;
+  double gap_ = 0;
+  size_t nodes_ = 0;
+  size_t cuts_ = 0;
+  bool prioritized_ = false; // The variables have different branching priorities
+  Clock::time_point searchStarted_;
+  double lpTime_ = 0; // Negative until the root relaxation is solved
+  Termination termination_ = MIPSolver::finished;
+
+  static int GetTimeLimit(Clock::time_point deadline);
+
+  template<class T>
+  friend void GlpkCallbackHelper(T *tree, void *param);
+};
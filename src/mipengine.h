@@ -0,0 +1,107 @@
+// MIT License
+//
+// Copyright (c) 2019 Ivan Kelarev
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "mipsolver.h"
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+class MIPSolver::Engine
+{
+public:
+  using Expression = MIPSolver::Expression;
+  using Condition = MIPSolver::Condition;
+  using Vector = std::vector<double>;
+  using Termination = MIPSolver::Termination;
+  using Clock = MIPSolver::Clock;
+  using Options = MIPSolver::Options;
+
+  virtual ~Engine() { }
+
+  // A new engine of the same kind and settings, without a model
+  virtual std::unique_ptr<Engine> Clone() const = 0;
+
+  // Variables and conditions are only appended between optimizations, except for the rolled back ones
+  // and the changed ones (bounds of variables and replaced conditions), which keep their indices
+  virtual void Rollback(size_t vars, size_t conds) = 0;
+  virtual void ChangeVariable(size_t var) = 0;
+  virtual void ChangeCondition(size_t cond) = 0;
+
+  struct Outcome
+  {
+    Vector x; // Empty if no feasible solution has been found
+    bool optimal = false;
+    double gap = INFINITY;
+    Termination termination = MIPSolver::finished;
+    size_t nodes = 0; // Branch and bound subproblems solved
+
+    // The rest of the optimization time is the search
+    double uploadTime = 0;
+    double lpTime = 0;
+
+    size_t lpIterations = 0;
+    size_t cuts = 0;
+  };
+
+  // The start is either empty or a feasible solution of the model
+  virtual void Minimize(const MIPSolver &s, const Expression &objective, const Vector &start, Outcome &outcome) = 0;
+
+protected:
+  using VariableInfo = MIPSolver::VariableInfo;
+  using Variable = MIPSolver::Variable;
+  using VariableType = MIPSolver::VariableType;
+
+  static const std::vector<VariableInfo> &GetVariables(const MIPSolver &s) { return s.vars_; }
+  static const std::vector<Condition> &GetConditions(const MIPSolver &s) { return s.conds_; }
+  static const std::vector<Condition> &GetLazyConditions(const MIPSolver &s) { return s.lazy_; }
+  static bool IsSatisfied(const Condition &cond, const Vector &x) { return MIPSolver::IsSatisfied(cond, x); }
+  static size_t GetThreads(const MIPSolver &s) { return s.threads_; }
+
+  using Square = MIPSolver::Square;
+  static const std::vector<Square> &GetSquares(const MIPSolver &s) { return s.squares_; }
+  static const Options &GetOptions(const MIPSolver &s) { return s.options_; }
+
+  // Models read from files are appended through these
+  static Variable CreateVariable(MIPSolver &s, VariableType type, double minValue, double maxValue)
+  {
+    return s.CreateVariable(type, minValue, maxValue);
+  }
+  static void AddCondition(MIPSolver &s, const Condition &cond) { s.AddCondition(cond); }
+
+  // The earlier of the solver deadline and the time limit of the options
+  static Clock::time_point GetDeadline(const MIPSolver &s, Clock::time_point start);
+
+  // Relative difference between the objective value and its bound, as GLPK computes it
+  static double GetGap(double value, double bound);
+
+  static double GetSeconds(Clock::time_point from, Clock::time_point to) { return MIPSolver::GetSeconds(from, to); }
+
+  // The relaxation and the proposed solution are of all variables
+  static bool HasHeuristic(const MIPSolver &s) { return s.heuristic_ || s.presolver_; }
+  static bool ProposeSolution(const MIPSolver &s, const Vector &relaxation, Vector &x) { return s.Propose(relaxation, x); }
+
+  // Returns false if the optimization should be terminated
+  static bool ReportStatus(const MIPSolver &s, int activeNodes, double progress);
+};
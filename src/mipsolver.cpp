@@ -21,40 +21,123 @@
 // SOFTWARE.
 
 #include "mipsolver.h"
+#include "bnbengine.h"
+#include "glpkengine.h"
+#include "mipengine.h"
+#include "presolver.h"
 
 #include <algorithm>
 #include <cassert>
+#include <cfloat>
 #include <cmath>
-#include <glpk.h>
 
 #ifdef _DEBUG
   #include <iostream>
 #endif
 
-namespace
+MIPSolver::MIPSolver(StatusCallback &&callback) : engine_(CreateEngine("GLPK")), callback_(callback)
 {
-  int Unused = glp_term_out(GLP_OFF);
+  // GLPK does not allow optimization without variables
+  Variable var = CreateVariable(continuous, 0, 0);
+
+  // GLPK does not allow optimization without conditions
+  AddCondition(var == 0);
 }
 
-template<class T>
-static void GlpkCallbackHelper(T *tree, void *param)
+MIPSolver::MIPSolver(const MIPSolver &s)
+  : vars_(s.vars_), conds_(s.conds_), lazy_(s.lazy_), auxs_(s.auxs_), squares_(s.squares_), created_(s.created_),
+    engine_(s.engine_->Clone()), threads_(s.threads_), options_(s.options_), deadline_(s.deadline_), callback_(s.callback_),
+    dump_(s.dump_), heuristic_(s.heuristic_)
 {
-  assert(param);
-  reinterpret_cast<MIPSolver *>(param)->GlpkCallback(tree);
+  // The copy uploads its model to its own engine on the first optimization
 }
 
-static void GlpkCallbackHelper(glp_tree *tree, void *param)
+MIPSolver::~MIPSolver()
 {
-  GlpkCallbackHelper<glp_tree>(tree, param);
 }
 
-MIPSolver::MIPSolver(StatusCallback &&callback) : callback_(callback)
+MIPSolver &MIPSolver::operator =(const MIPSolver &s)
 {
-  // GLPK does not allow optimization without variables
-  Variable var = CreateVariable(GLP_CV, 0, 0);
+  if (this != &s)
+  {
+    engine_ = s.engine_->Clone();
+
+    vars_ = s.vars_;
+    conds_ = s.conds_;
+    lazy_ = s.lazy_;
+    auxs_ = s.auxs_;
+    squares_ = s.squares_;
+    created_ = s.created_;
+    threads_ = s.threads_;
+    options_ = s.options_;
+    deadline_ = s.deadline_;
+    callback_ = s.callback_;
+    dump_ = s.dump_;
+    heuristic_ = s.heuristic_;
+  }
+  return *this;
+}
 
-  // GLPK does not allow optimization without conditions
-  AddCondition(var == 0);
+std::unique_ptr<MIPSolver::Engine> MIPSolver::CreateEngine(const std::string &name)
+{
+  if (name == "GLPK")
+  {
+    return std::unique_ptr<Engine>(new GlpkEngine());
+  }
+  else if (name == "BNB")
+  {
+    return std::unique_ptr<Engine>(new BnbEngine());
+  }
+
+  return nullptr;
+}
+
+bool MIPSolver::SetEngine(const std::string &name)
+{
+  std::unique_ptr<Engine> engine = CreateEngine(name);
+  if (!engine)
+  {
+    return false;
+  }
+
+  // The new engine receives the whole model on the next optimization
+  engine_ = std::move(engine);
+  return true;
+}
+
+void MIPSolver::SetThreads(size_t threads)
+{
+  threads_ = threads;
+}
+
+void MIPSolver::SetOptions(const Options &options)
+{
+  options_ = options;
+}
+
+const MIPSolver::Options &MIPSolver::GetOptions() const
+{
+  return options_;
+}
+
+void MIPSolver::SetModelDump(ModelDump &&dump)
+{
+  dump_ = dump;
+}
+
+void MIPSolver::SetHeuristic(Heuristic &&heuristic)
+{
+  heuristic_ = heuristic;
+}
+
+bool MIPSolver::LoadModel(const std::string &file, Expression &objective)
+{
+  return GlpkEngine::ReadModel(file, *this, objective);
+}
+
+void MIPSolver::SetDeadline(Clock::time_point deadline)
+{
+  deadline_ = deadline;
 }
 
 MIPSolver::Variable MIPSolver::GetBinaryVariable()
@@ -72,9 +155,41 @@ MIPSolver::Variable MIPSolver::GetIntegerVariable(double maxValue)
   return std::move(CreateIntegerVariable(0, maxValue));
 }
 
-void MIPSolver::Restrict(const Condition &cond)
+void MIPSolver::SetBranchingPriority(const Variable &var, int priority)
+{
+  size_t i = GetIndex(var);
+  assert(i < vars_.size());
+  vars_[i].priority = priority;
+}
+
+size_t MIPSolver::Restrict(const Condition &cond)
 {
   AddCondition(cond);
+  return conds_.size() - 1;
+}
+
+void MIPSolver::Replace(size_t index, const Condition &cond)
+{
+  assert(index < conds_.size());
+  conds_[index] = cond;
+  engine_->ChangeCondition(index);
+}
+
+void MIPSolver::SetBounds(const Variable &var, double minValue, double maxValue)
+{
+  size_t i = GetIndex(var);
+  assert(i < vars_.size());
+  assert(minValue <= maxValue);
+  assert(vars_[i].type != binary || (minValue >= 0 && maxValue <= 1));
+
+  vars_[i].min = minValue;
+  vars_[i].max = maxValue;
+  engine_->ChangeVariable(i);
+}
+
+void MIPSolver::RestrictLazily(const Condition &cond)
+{
+  lazy_.push_back(cond);
 }
 
 MIPSolver::Checkpoint MIPSolver::CreateCheckpoint() const
@@ -82,6 +197,7 @@ MIPSolver::Checkpoint MIPSolver::CreateCheckpoint() const
   Checkpoint cp;
   cp.vars = vars_.size();
   cp.conds = conds_.size();
+  cp.lazy = lazy_.size();
   return cp;
 }
 
@@ -89,12 +205,30 @@ void MIPSolver::Rollback(const Checkpoint &cp)
 {
   assert(cp.vars <= vars_.size());
   assert(cp.conds <= conds_.size());
+  assert(cp.lazy <= lazy_.size());
+
+  // Keep the engine in sync, so the next optimization uploads only what was added after this point
+  engine_->Rollback(cp.vars, cp.conds);
+
+  while (!auxs_.empty() && auxs_.back().var >= cp.vars)
+  {
+    auxs_.pop_back();
+  }
+
+  while (!squares_.empty() && squares_.back().var >= cp.vars)
+  {
+    squares_.pop_back();
+  }
 
   vars_.resize(cp.vars);
   conds_.resize(cp.conds, Expression() == 0);
+  lazy_.resize(cp.lazy, Expression() == 0);
+
+  // The part after the checkpoint is built again from here
+  built_ = Clock::now();
 }
 
-MIPSolver::Expression MIPSolver::GetAbsoluteValue(const Expression &expr)
+MIPSolver::Expression MIPSolver::GetAbsoluteValue(const Expression &expr, Encoding encoding)
 {
   double minValue;
   double maxValue;
@@ -113,6 +247,25 @@ MIPSolver::Expression MIPSolver::GetAbsoluteValue(const Expression &expr)
     assert(maxValue > 0);
     assert(minValue < 0);
 
+    if (encoding == convexEncoding)
+    {
+      Variable pos = CreateContinuousVariable(0, maxValue);
+      Variable neg = CreateContinuousVariable(minValue, 0);
+
+      // Both parts may be nonzero, but not in the optimum
+      AddCondition(pos + neg == expr);
+
+      size_t p = GetIndex(pos), n = GetIndex(neg);
+      AddAuxiliary(p, [expr, p, n](Vector &x)
+      {
+        double v = Evaluate(expr, x);
+        x[p] = std::max(v, 0.);
+        x[n] = std::min(v, 0.);
+      });
+
+      return std::move(pos - neg);
+    }
+
     Variable isPositive = CreateBinaryVariable();
     Variable pos = CreateContinuousVariable(0, maxValue);
     Variable neg = CreateContinuousVariable(minValue, 0);
@@ -122,11 +275,50 @@ MIPSolver::Expression MIPSolver::GetAbsoluteValue(const Expression &expr)
     AddCondition(pos <= maxValue * isPositive);
     AddCondition(neg >= minValue * (1 - isPositive));
 
+    size_t i = GetIndex(isPositive), p = GetIndex(pos), n = GetIndex(neg);
+    AddAuxiliary(i, [expr, i, p, n](Vector &x)
+    {
+      double v = Evaluate(expr, x);
+      x[i] = v > 0 ? 1 : 0;
+      x[p] = std::max(v, 0.);
+      x[n] = std::min(v, 0.);
+    });
+
     return std::move(pos - neg);
   }
 }
 
-MIPSolver::Expression MIPSolver::GetSquareApproximation(const Expression &expr, RefPoints &points)
+MIPSolver::Expression MIPSolver::GetSquare(const Expression &expr)
+{
+  double minValue, maxValue;
+  GetExpressionBounds(expr, minValue, maxValue);
+
+  if (minValue == maxValue)
+  {
+    return minValue * maxValue;
+  }
+
+  double maxSquare = std::max(minValue * minValue, maxValue * maxValue);
+  double minSquare = minValue > 0 ? minValue * minValue : maxValue < 0 ? maxValue * maxValue : 0;
+  Variable y = CreateContinuousVariable(minSquare, maxSquare);
+
+  // The tangents at the bounds give the relaxation a reasonable start
+  AddCondition(y >= 2 * minValue * expr - minValue * minValue);
+  AddCondition(y >= 2 * maxValue * expr - maxValue * maxValue);
+
+  size_t i = GetIndex(y);
+  squares_.push_back({ i, expr.GetFactors(), expr.GetC() });
+
+  AddAuxiliary(i, [expr, i](Vector &x)
+  {
+    double v = Evaluate(expr, x);
+    x[i] = v * v;
+  });
+
+  return std::move(y);
+}
+
+MIPSolver::Expression MIPSolver::GetSquareApproximation(const Expression &expr, RefPoints &points, Encoding encoding)
 {
   double minValue, maxValue;
   GetExpressionBounds(expr, minValue, maxValue);
@@ -140,28 +332,50 @@ MIPSolver::Expression MIPSolver::GetSquareApproximation(const Expression &expr,
   {
     points.insert(std::min(std::max(0., minValue), maxValue));
   }
+  points.added_.clear();
 
-  auto p1 = points.begin();
-  double x1 = minValue;
-  double y1 = p1 * (2 * x1 - p1);
-
-  Expression parts, source, result;
-  for (; p1 != points.end(); p1++)
+  // Breakpoints of the tangents to the square at the refpoints
+  std::vector<double> bx(1, minValue);
+  std::vector<double> by(1, points.begin() * (2 * minValue - points.begin()));
+  for (auto p1 = points.begin(); p1 != points.end(); p1++)
   {
     auto p2 = std::next(p1);
-
-    double x2, y2;
     if (p2 != points.end())
     {
-      x2 = (p1 + p2) / 2;
-      y2 = p1 * p2;
+      bx.push_back((p1 + p2) / 2);
+      by.push_back(p1 * p2);
     }
     else
     {
-      x2 = maxValue;
-      y2 = p1 * (2 * x2 - p1);
+      bx.push_back(maxValue);
+      by.push_back(p1 * (2 * maxValue - p1));
     }
-    assert(x2 > x1);
+    assert(bx.back() > bx[bx.size() - 2]);
+  }
+
+  if (encoding == logarithmicEncoding)
+  {
+    return std::move(GetLogarithmicApproximation(expr, bx, by));
+  }
+  else if (encoding == convexEncoding)
+  {
+    return std::move(GetConvexApproximation(expr, points, by));
+  }
+
+  struct Segment
+  {
+    size_t enable;
+    size_t x;
+    double x1;
+    double x2;
+  };
+  std::vector<Segment> segments;
+
+  Expression parts, source, result;
+  for (size_t i = 0; i + 1 < bx.size(); i++)
+  {
+    double x1 = bx[i], x2 = bx[i + 1];
+    double y1 = by[i], y2 = by[i + 1];
 
     Variable enable = CreateBinaryVariable();
     parts += enable;
@@ -172,24 +386,302 @@ MIPSolver::Expression MIPSolver::GetSquareApproximation(const Expression &expr,
     source += x + x1 * enable;
     result += (y2 - y1) / (x2 - x1) * x + y1 * enable;
 
-    x1 = x2;
-    y1 = y2;
+    segments.push_back({ GetIndex(enable), GetIndex(x), x1, x2 });
   }
 
   AddCondition(parts == 1);
   AddCondition(expr == source);
 
+  AddAuxiliary(segments.front().enable, [expr, segments](Vector &x)
+  {
+    double v = Evaluate(expr, x);
+
+    bool found = false;
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+      const Segment &sg = segments[i];
+      bool enable = !found && (v <= sg.x2 || i + 1 == segments.size());
+      x[sg.enable] = enable ? 1 : 0;
+      x[sg.x] = enable ? std::min(std::max(v - sg.x1, 0.), sg.x2 - sg.x1) : 0;
+      found = found || enable;
+    }
+  });
+
+  return std::move(result);
+}
+
+MIPSolver::Expression MIPSolver::RefineSquareApproximation(const Expression &approximation, const Expression &expr,
+  RefPoints &points)
+{
+  double minValue, maxValue;
+  GetExpressionBounds(expr, minValue, maxValue);
+
+  Vector added;
+  added.swap(points.added_);
+  if (minValue == maxValue || added.empty())
+  {
+    return approximation;
+  }
+
+  // A new variable above both the approximation and the new tangents, so that a solution found before
+  // derives its value like a start does (the approximation itself keeps its variables and conditions)
+  double minApprox, maxApprox;
+  GetExpressionBounds(approximation, minApprox, maxApprox);
+  double maxSquare = std::max(minValue * minValue, maxValue * maxValue);
+  Variable y = CreateContinuousVariable(minApprox, std::max(maxApprox, maxSquare));
+
+  AddCondition(y >= approximation);
+  for (auto it = added.begin(); it != added.end(); it++)
+  {
+    AddCondition(y >= 2 * *it * expr - *it * *it);
+  }
+
+  size_t i = GetIndex(y);
+  AddAuxiliary(i, [approximation, expr, added, i](Vector &x)
+  {
+    double v = Evaluate(expr, x);
+
+    double value = Evaluate(approximation, x);
+    for (size_t j = 0; j < added.size(); j++)
+    {
+      value = std::max(value, added[j] * (2 * v - added[j]));
+    }
+    x[i] = value;
+  });
+
+  return std::move(y);
+}
+
+MIPSolver::Expression MIPSolver::GetConvexApproximation(
+  const Expression &expr, RefPoints &points, const Vector &by)
+{
+  // The maximum of the tangents is the same function as the one of the segments
+  Variable y = CreateContinuousVariable(*std::min_element(by.begin(), by.end()), *std::max_element(by.begin(), by.end()));
+
+  Vector refpoints;
+  for (auto p = points.begin(); p != points.end(); p++)
+  {
+    refpoints.push_back(p);
+    AddCondition(y >= 2 * refpoints.back() * expr - refpoints.back() * refpoints.back());
+  }
+
+  size_t i = GetIndex(y);
+  AddAuxiliary(i, [expr, refpoints, i](Vector &x)
+  {
+    double v = Evaluate(expr, x);
+
+    double value = -INFINITY;
+    for (size_t j = 0; j < refpoints.size(); j++)
+    {
+      value = std::max(value, refpoints[j] * (2 * v - refpoints[j]));
+    }
+    x[i] = value;
+  });
+
+  return std::move(y);
+}
+
+MIPSolver::Expression MIPSolver::GetLogarithmicApproximation(
+  const Expression &expr, const std::vector<double> &bx, const std::vector<double> &by)
+{
+  // Convex combination of the breakpoints where only two neighbours may be nonzero (SOS2), the segment
+  // is selected by its reflected Gray code, so that neighbouring segments differ in a single binary
+  size_t segments = bx.size() - 1;
+  auto code = [](size_t segment) { return segment ^ (segment >> 1); };
+
+  size_t bits = 0;
+  while ((static_cast<size_t>(1) << bits) < segments) bits++;
+
+  std::vector<Variable> z;
+  for (size_t l = 0; l < bits; l++)
+  {
+    z.push_back(CreateBinaryVariable());
+  }
+
+  std::vector<Variable> lambda;
+  Expression sum, source, result;
+  for (size_t i = 0; i < bx.size(); i++)
+  {
+    lambda.push_back(CreateContinuousVariable(0, 1));
+    sum += lambda.back();
+    source += bx[i] * lambda.back();
+    result += by[i] * lambda.back();
+  }
+
+  AddCondition(sum == 1);
+  AddCondition(expr == source);
+
+  // A breakpoint may be used only if the code of one of its adjacent segments matches the binaries
+  for (size_t l = 0; l < bits; l++)
+  {
+    Expression ones, zeros;
+    for (size_t i = 0; i < bx.size(); i++)
+    {
+      bool one = true, zero = true;
+      if (i > 0)
+      {
+        bool bit = (code(i - 1) >> l) & 1;
+        one = one && bit;
+        zero = zero && !bit;
+      }
+      if (i < segments)
+      {
+        bool bit = (code(i) >> l) & 1;
+        one = one && bit;
+        zero = zero && !bit;
+      }
+
+      if (one) ones += lambda[i];
+      if (zero) zeros += lambda[i];
+    }
+    AddCondition(ones <= z[l]);
+    AddCondition(zeros <= 1 - z[l]);
+  }
+
+  std::vector<size_t> zi, li;
+  for (size_t l = 0; l < z.size(); l++) zi.push_back(GetIndex(z[l]));
+  for (size_t i = 0; i < lambda.size(); i++) li.push_back(GetIndex(lambda[i]));
+
+  AddAuxiliary(bits > 0 ? zi.front() : li.front(), [expr, bx, zi, li, code](Vector &x)
+  {
+    double v = Evaluate(expr, x);
+
+    size_t segment = 0;
+    while (segment + 1 < bx.size() - 1 && v > bx[segment + 1]) segment++;
+
+    double x1 = bx[segment], x2 = bx[segment + 1];
+    double t = std::min(std::max((v - x1) / (x2 - x1), 0.), 1.);
+
+    for (size_t i = 0; i < li.size(); i++)
+    {
+      x[li[i]] = i == segment ? 1 - t : i == segment + 1 ? t : 0;
+    }
+    for (size_t l = 0; l < zi.size(); l++)
+    {
+      x[zi[l]] = (code(segment) >> l) & 1 ? 1 : 0;
+    }
+  });
+
   return std::move(result);
 }
 
 MIPSolver::Solution MIPSolver::Minimize(const Expression &expr)
 {
-  return std::move(Optimize(expr));
+  return std::move(Optimize(expr, Solution()));
+}
+
+MIPSolver::Solution MIPSolver::Minimize(const Expression &expr, const Solution &start)
+{
+  return std::move(Optimize(expr, start));
 }
 
 MIPSolver::Solution MIPSolver::Maximize(const Expression &expr)
 {
-  return std::move(Optimize(-expr));
+  return std::move(Optimize(-expr, Solution()));
+}
+
+MIPSolver::Solution MIPSolver::Maximize(const Expression &expr, const Solution &start)
+{
+  return std::move(Optimize(-expr, start));
+}
+
+std::vector<MIPSolver::Solution> MIPSolver::FindAlternatives(const Expression &expr, const Solution &sol,
+  const std::vector<Expression> &indicators, size_t count)
+{
+  Checkpoint cp = CreateCheckpoint();
+
+  std::vector<Solution> res;
+  res.reserve(count);
+  const Solution *last = &sol;
+  while (*last && res.size() < count && !indicators.empty())
+  {
+    // At least one of the indicators has to flip
+    Expression flips;
+    for (auto it = indicators.begin(); it != indicators.end(); it++)
+    {
+      flips += (*last)(*it) > 0.5 ? 1 - *it : *it;
+    }
+    AddCondition(flips >= 1);
+
+    Solution alt = Optimize(expr, Solution());
+    if (!alt) break;
+
+    bool finished = alt.termination_ == MIPSolver::finished;
+    res.push_back(std::move(alt));
+    last = &res.back();
+
+    if (!finished) break;
+  }
+
+  Rollback(cp);
+  return res;
+}
+
+MIPSolver::Solution MIPSolver::MinimizeLexicographic(const std::vector<Expression> &objectives,
+  const std::vector<double> &tolerances)
+{
+  std::vector<Objective> built;
+  for (auto it = objectives.begin(); it != objectives.end(); it++)
+  {
+    const Expression &objective = *it;
+    built.push_back([objective]() { return objective; });
+  }
+
+  return std::move(MinimizeLexicographic(built, tolerances, Solution()));
+}
+
+MIPSolver::Solution MIPSolver::MinimizeLexicographic(const std::vector<Objective> &objectives,
+  const std::vector<double> &tolerances, const Solution &start)
+{
+  assert(tolerances.empty() || tolerances.size() == objectives.size());
+
+  // Unless the builders create variables, only conditions are added, so the rollback keeps the engine problem
+  // and its basis
+  Checkpoint cp = CreateCheckpoint();
+
+  Solution sol = start;
+  Statistics total;
+  bool optimal = true;
+  Expression previous;
+  for (size_t i = 0; i < objectives.size(); i++)
+  {
+    if (i > 0)
+    {
+      // The previous optimum is met by its own solution despite rounding errors
+      double value = sol(previous);
+      double tolerance = tolerances.empty() ? 0 : tolerances[i - 1];
+      assert(tolerance >= 0);
+      AddCondition(previous <= value + tolerance + 1e-9 * (1 + fabs(value)));
+    }
+
+    previous = objectives[i]();
+    sol = Optimize(previous, sol);
+
+    const Statistics &st = sol.statistics_;
+    total.buildTime += st.buildTime;
+    total.uploadTime += st.uploadTime;
+    total.lpTime += st.lpTime;
+    total.searchTime += st.searchTime;
+    total.nodes += st.nodes;
+    total.lpIterations += st.lpIterations;
+    total.cuts += st.cuts;
+    total.dumpFailed = total.dumpFailed || st.dumpFailed;
+    optimal = optimal && sol.optimal_;
+
+    if (!sol || sol.termination_ != finished) break;
+  }
+
+  Rollback(cp);
+
+  // The gap and the size are of the last solved level
+  total.gap = sol.statistics_.gap;
+  total.variables = sol.statistics_.variables;
+  total.conditions = sol.statistics_.conditions;
+  total.nonzeros = sol.statistics_.nonzeros;
+  sol.statistics_ = total;
+  sol.optimal_ = optimal;
+
+  return sol;
 }
 
 double MIPSolver::SignedFloor(double x)
@@ -207,11 +699,51 @@ double MIPSolver::SignedFloor(double x)
   return res;
 }
 
+double MIPSolver::Evaluate(const Expression &expr, const Vector &x)
+{
+  double res = expr.GetC();
+
+  const Expression::Factors &f = expr.GetFactors();
+  for (auto it = f.begin(); it != f.end(); it++)
+  {
+    assert(it->first < x.size());
+    res += x[it->first] * it->second;
+  }
+
+  return res;
+}
+
+bool MIPSolver::IsSatisfied(const Condition &cond, const Vector &x)
+{
+  const double eps = 1e-6;
+
+  double v = Evaluate(cond.GetExpression(), x);
+  double tol = eps * (1 + fabs(cond.GetExpression().GetC()));
+
+  Relation rel = cond.GetRelation();
+  if (rel == lessOrEqual && v > tol) return false;
+  if (rel == greaterOrEqual && v < -tol) return false;
+  if (rel == equal && fabs(v) > tol) return false;
+  return true;
+}
+
+size_t MIPSolver::GetIndex(const Variable &var)
+{
+  const Expression::Factors &f = var.GetFactors();
+  assert(f.size() == 1);
+  return f.begin()->first;
+}
+
+double MIPSolver::GetSeconds(Clock::time_point from, Clock::time_point to)
+{
+  return std::chrono::duration<double>(to - from).count();
+}
+
 void MIPSolver::GetExpressionBounds(const Expression &expr, double &minValue, double &maxValue)
 {
   minValue = maxValue = expr.GetC();
 
-  const Expression::FactorMap &f = expr.GetFactors();
+  const Expression::Factors &f = expr.GetFactors();
   for (auto it = f.begin(); it != f.end(); it++)
   {
     assert(it->first < vars_.size());
@@ -235,26 +767,26 @@ void MIPSolver::GetExpressionBounds(const Expression &expr, double &minValue, do
 
 MIPSolver::Variable MIPSolver::CreateBinaryVariable()
 {
-  return std::move(CreateVariable(GLP_BV, 0, 1));
+  return std::move(CreateVariable(binary, 0, 1));
 }
 
 MIPSolver::Variable MIPSolver::CreateIntegerVariable(double minValue, double maxValue)
 {
   assert(minValue <= maxValue);
   assert(SignedFloor(minValue) <= SignedFloor(maxValue));
-  return std::move(CreateVariable(GLP_IV, SignedFloor(minValue), SignedFloor(maxValue)));
+  return std::move(CreateVariable(integer, SignedFloor(minValue), SignedFloor(maxValue)));
 }
 
 MIPSolver::Variable MIPSolver::CreateContinuousVariable(double minValue, double maxValue)
 {
   assert(minValue <= maxValue);
-  return std::move(CreateVariable(GLP_CV, minValue, maxValue));
+  return std::move(CreateVariable(continuous, minValue, maxValue));
 }
 
-MIPSolver::Variable MIPSolver::CreateVariable(int type, double minValue, double maxValue)
+MIPSolver::Variable MIPSolver::CreateVariable(VariableType type, double minValue, double maxValue)
 {
   MIPSolver::Variable var(*this, static_cast<int>(vars_.size()));
-  vars_.push_back({ type, minValue, maxValue });
+  vars_.push_back({ type, minValue, maxValue, created_++, 0 });
   return std::move(var);
 }
 
@@ -263,120 +795,185 @@ void MIPSolver::AddCondition(const Condition &cond)
   conds_.push_back(cond);
 }
 
-MIPSolver::Solution MIPSolver::Optimize(const Expression &expr)
+void MIPSolver::AddAuxiliary(size_t firstVar, std::function<void (Vector &x)> &&fill)
 {
-  glp_prob *lp = glp_create_prob();
-
-  glp_add_cols(lp, static_cast<int>(vars_.size()));
-  glp_add_rows(lp, static_cast<int>(conds_.size()));
+  assert(firstVar < vars_.size());
+  assert(auxs_.empty() || auxs_.back().var < firstVar);
+  auxs_.push_back({ firstVar, fill });
+}
 
-  std::vector<int> idx(vars_.size() + 1);
-  for (int i = 0; i < vars_.size(); i++)
+bool MIPSolver::CompleteSolution(const Solution &start, Vector &x) const
+{
+  // Variables recreated after a rollback have the same indices but are not the ones the solution knows
+  size_t known = 0;
+  while (known < start.x_.size() && known < vars_.size() && vars_[known].serial < start.created_)
   {
-    idx[i + 1] = i + 1;
+    known++;
+  }
 
-    const VariableInfo &vi = vars_[i];
-    assert(vi.type == GLP_IV || vi.type == GLP_CV || vi.type == GLP_BV);
-    glp_set_col_kind(lp, i + 1, vi.type);
+  x.assign(start.x_.begin(), start.x_.begin() + known);
+  x.resize(vars_.size(), NAN);
 
-    if (vi.min == vi.max)
-    {
-      glp_set_col_bnds(lp, i + 1, GLP_FX, vi.min, vi.max);
-    }
-    else
+  for (size_t i = 0; i < auxs_.size(); i++)
+  {
+    if (auxs_[i].var >= known)
     {
-      glp_set_col_bnds(lp, i + 1, GLP_DB, vi.min, vi.max);
+      auxs_[i].fill(x);
     }
   }
 
-  for (int i = 0; i < conds_.size(); i++)
-  {
-    std::vector<double> row(vars_.size() + 1);
+  return IsFeasible(x);
+}
 
-    const Condition &cond = conds_[i];
-    const Expression &expr = cond.GetExpression();
-    const Expression::FactorMap &f = expr.GetFactors();
-    for (auto it = f.begin(); it != f.end(); it++)
-    {
-      row[it->first + 1] = it->second;
-    }
-    glp_set_mat_row(lp, i + 1, static_cast<int>(vars_.size()), &idx.front(), &row.front());
+bool MIPSolver::IsFeasible(const Vector &x) const
+{
+  assert(x.size() == vars_.size());
+
+  const double eps = 1e-6;
 
-    int rel = cond.GetRelation();
-    assert(rel == GLP_FX || rel == GLP_LO || rel == GLP_UP);
-    glp_set_row_bnds(lp, i + 1, rel, -expr.GetC(), -expr.GetC());
+  for (size_t i = 0; i < vars_.size(); i++)
+  {
+    const VariableInfo &vi = vars_[i];
+    if (std::isnan(x[i])) return false;
+    if (x[i] < vi.min - eps || x[i] > vi.max + eps) return false;
+    if (vi.type != continuous && fabs(x[i] - round(x[i])) > eps) return false;
   }
 
-  const Expression::FactorMap &f = expr.GetFactors();
-  for (auto it = f.begin(); it != f.end(); it++)
+  for (size_t i = 0; i < conds_.size(); i++)
   {
-    glp_set_obj_coef(lp, static_cast<int>(it->first + 1), it->second);
+    if (!IsSatisfied(conds_[i], x)) return false;
   }
 
-  Solution res;
+  for (size_t i = 0; i < lazy_.size(); i++)
+  {
+    if (!IsSatisfied(lazy_[i], x)) return false;
+  }
 
-  glp_iocp iocp;
-  glp_init_iocp(&iocp);
-  iocp.msg_lev  = GLP_MSG_OFF;
-  iocp.br_tech  = GLP_BR_DTH;
-  iocp.bt_tech  = GLP_BT_BLB;
-  iocp.pp_tech  = GLP_PP_ROOT;
-  iocp.mir_cuts = GLP_OFF;
-  iocp.gmi_cuts = GLP_OFF;
-  iocp.cov_cuts = GLP_OFF;
-  iocp.clq_cuts = GLP_OFF;
-  iocp.presolve = GLP_ON;
+  return true;
+}
 
-  if (callback_)
+bool MIPSolver::Propose(const Vector &relaxation, Vector &x) const
+{
+  if (presolver_)
   {
-    callback_(0, 0);
+    return presolver_->Propose(relaxation, x);
+  }
 
-    iocp.cb_func = &GlpkCallbackHelper;
-    iocp.cb_info = this;
+  assert(relaxation.size() == vars_.size());
+  Proposal proposal(relaxation);
+  if (!heuristic_ || !heuristic_(Solution(relaxation, created_), proposal))
+  {
+    return false;
   }
 
-  if (glp_intopt(lp, &iocp) == 0)
+  x = std::move(proposal.x_);
+  for (size_t i = 0; i < vars_.size(); i++)
   {
-    int status = glp_mip_status(lp);
-    if (status == GLP_OPT)
+    if (vars_[i].type != continuous)
     {
-      Solution::Vector v(vars_.size());
-      for (int i = 0; i < vars_.size(); i++)
-      {
-        v[i] = glp_mip_col_val(lp, i + 1);
-      }
-      res = Solution(v);
+      x[i] = round(x[i]);
     }
   }
 
-  glp_delete_prob(lp);
-
-  if (callback_)
+  // The derived variables follow the decided ones rather than the relaxation
+  for (size_t i = 0; i < auxs_.size(); i++)
   {
-    callback_(0, 1);
+    auxs_[i].fill(x);
   }
 
-  return res;
+  return IsFeasible(x);
 }
 
-template<class T>
-void MIPSolver::GlpkCallback(T *tree) const
+MIPSolver::Solution MIPSolver::Optimize(const Expression &expr, const Solution &start)
 {
-  if (glp_ios_reason(tree) == GLP_ISELECT) // Do not do this too often
+  Statistics statistics;
+  statistics.buildTime = GetSeconds(built_, Clock::now());
+  statistics.variables = vars_.size();
+  statistics.conditions = conds_.size();
+  for (auto it = conds_.begin(); it != conds_.end(); it++)
+  {
+    statistics.nonzeros += it->GetExpression().GetFactors().size();
+  }
+
+  Vector x0;
+  if (start && !CompleteSolution(start, x0))
+  {
+    x0.clear();
+  }
+
+  if (dump_)
+  {
+    std::string file = dump_();
+    if (!file.empty())
+    {
+      // A failed dump must not break the optimization itself, it is only reported
+      statistics.dumpFailed = !GlpkEngine::WriteModel(*this, expr, file);
+    }
+  }
+
+  if (callback_)
   {
-    int a, n, t;
-    glp_ios_tree_size(tree, &a, &n, &t);
+    callback_(0, 0);
+  }
 
-    double gap = glp_ios_mip_gap(tree);
-    if (gap < 0) gap = 0;
-    if (gap > 1) gap = 1;
+  Clock::time_point started = Clock::now();
 
-    assert(callback_);
-    if (!callback_(a, 1 - gap))
+  Engine::Outcome outcome;
+  if (deadline_ <= started)
+  {
+    outcome.termination = timeout;
+  }
+  else if (options_.reduceModel)
+  {
+    // Nothing is found if the presolver proves the model infeasible
+    Presolver presolver(*this);
+    statistics.uploadTime = GetSeconds(started, Clock::now());
+    if (!presolver.IsInfeasible())
     {
-      glp_ios_terminate(tree);
+      engine_->Clone()->Minimize(presolver.GetModel(), presolver.Reduce(expr), presolver.Reduce(x0), outcome);
+      outcome.x = presolver.Restore(outcome.x);
     }
   }
+  else
+  {
+    engine_->Minimize(*this, expr, x0, outcome);
+  }
+
+  double total = GetSeconds(started, Clock::now());
+  statistics.uploadTime += outcome.uploadTime;
+  statistics.lpTime = outcome.lpTime;
+  statistics.searchTime = std::max(0.0, total - statistics.uploadTime - statistics.lpTime);
+  statistics.nodes = outcome.nodes;
+  statistics.lpIterations = outcome.lpIterations;
+  statistics.cuts = outcome.cuts;
+
+  // The start is still better than nothing if the engine has been stopped before finding anything
+  if (outcome.x.empty() && !x0.empty())
+  {
+    outcome.x = std::move(x0);
+    outcome.optimal = false;
+    outcome.gap = INFINITY;
+  }
+
+  Solution res;
+  if (!outcome.x.empty())
+  {
+    assert(outcome.x.size() == vars_.size());
+    res = Solution(outcome.x, created_);
+    res.optimal_ = outcome.optimal;
+    res.gap_ = outcome.optimal ? 0 : outcome.gap;
+  }
+  res.termination_ = outcome.termination;
+  statistics.gap = res ? res.gap_ : INFINITY;
+  res.statistics_ = statistics;
+
+  if (callback_)
+  {
+    callback_(0, 1);
+  }
+
+  built_ = Clock::now();
+  return res;
 }
 
 #ifdef _DEBUG
@@ -386,7 +983,7 @@ void MIPSolver::Dump() const
   {
     const Condition &cond = conds_[i];
     const Expression &expr = cond.GetExpression();
-    const Expression::FactorMap &f = expr.GetFactors();
+    const Expression::Factors &f = expr.GetFactors();
     for (auto it = f.begin(); it != f.end(); it++)
     {
       if (it->second == 1)
@@ -399,10 +996,10 @@ void MIPSolver::Dump() const
         std::cout << it->second << " * x" << it->first << " ";
     }
 
-    int rel = cond.GetRelation();
-    if (rel == GLP_FX) std::cout << "==";
-    else if (rel == GLP_UP) std::cout << "<=";
-    else if (rel == GLP_LO) std::cout << ">=";
+    Relation rel = cond.GetRelation();
+    if (rel == equal) std::cout << "==";
+    else if (rel == lessOrEqual) std::cout << "<=";
+    else if (rel == greaterOrEqual) std::cout << ">=";
 
     std::cout << " " << -expr.GetC() << std::endl;
   }
@@ -411,100 +1008,225 @@ void MIPSolver::Dump() const
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-MIPSolver::Expression MIPSolver::Expression::operator -() const
+MIPSolver::Expression MIPSolver::Expression::operator -() const &
 {
-  return std::move(*this * -1);
+  return std::move(Expression(*this) *= -1);
 }
 
-MIPSolver::Expression MIPSolver::Expression::operator +(const Expression &expr) const
+MIPSolver::Expression MIPSolver::Expression::operator -() &&
+{
+  return std::move(*this *= -1);
+}
+
+MIPSolver::Expression MIPSolver::Expression::operator +(const Expression &expr) const &
 {
   return std::move(Expression(*this) += expr);
 }
 
-MIPSolver::Expression MIPSolver::Expression::operator -(const Expression &expr) const
+MIPSolver::Expression MIPSolver::Expression::operator +(const Expression &expr) &&
+{
+  return std::move(*this += expr);
+}
+
+MIPSolver::Expression MIPSolver::Expression::operator +(Expression &&expr) const &
+{
+  return std::move(expr += *this);
+}
+
+MIPSolver::Expression MIPSolver::Expression::operator +(Expression &&expr) &&
+{
+  return std::move(*this += expr);
+}
+
+MIPSolver::Expression MIPSolver::Expression::operator -(const Expression &expr) const &
 {
   return std::move(Expression(*this) -= expr);
 }
 
-MIPSolver::Expression MIPSolver::Expression::operator +(double n) const
+MIPSolver::Expression MIPSolver::Expression::operator -(const Expression &expr) &&
+{
+  return std::move(*this -= expr);
+}
+
+MIPSolver::Expression MIPSolver::Expression::operator -(Expression &&expr) const &
+{
+  return std::move((expr *= -1) += *this);
+}
+
+MIPSolver::Expression MIPSolver::Expression::operator -(Expression &&expr) &&
+{
+  return std::move(*this -= expr);
+}
+
+MIPSolver::Expression MIPSolver::Expression::operator +(double n) const &
 {
   return std::move(Expression(*this) += n);
 }
 
-MIPSolver::Expression MIPSolver::Expression::operator -(double n) const
+MIPSolver::Expression MIPSolver::Expression::operator +(double n) &&
+{
+  return std::move(*this += n);
+}
+
+MIPSolver::Expression MIPSolver::Expression::operator -(double n) const &
 {
   return std::move(Expression(*this) -= n);
 }
 
-MIPSolver::Expression MIPSolver::Expression::operator *(double n) const
+MIPSolver::Expression MIPSolver::Expression::operator -(double n) &&
+{
+  return std::move(*this -= n);
+}
+
+MIPSolver::Expression MIPSolver::Expression::operator *(double n) const &
 {
   return std::move(Expression(*this) *= n);
 }
 
-MIPSolver::Expression MIPSolver::Expression::operator /(double n) const
+MIPSolver::Expression MIPSolver::Expression::operator *(double n) &&
+{
+  return std::move(*this *= n);
+}
+
+MIPSolver::Expression MIPSolver::Expression::operator /(double n) const &
 {
   return std::move(Expression(*this) /= n);
 }
 
-const MIPSolver::Expression &MIPSolver::Expression::operator +=(const Expression &expr)
+MIPSolver::Expression MIPSolver::Expression::operator /(double n) &&
 {
-  for (auto it = expr.f_.begin(); it != expr.f_.end(); it++)
-  {
-    f_[it->first] += it->second;
-  }
-  c_ += expr.c_;
+  return std::move(*this /= n);
+}
+
+MIPSolver::Expression &MIPSolver::Expression::operator +=(const Expression &expr)
+{
+  Add(expr, 1);
   return *this;
 }
 
-const MIPSolver::Expression &MIPSolver::Expression::operator -=(const Expression &expr)
+MIPSolver::Expression &MIPSolver::Expression::operator -=(const Expression &expr)
 {
-  return *this += -expr;
+  Add(expr, -1);
+  return *this;
 }
 
-const MIPSolver::Expression &MIPSolver::Expression::operator +=(double n)
+MIPSolver::Expression &MIPSolver::Expression::operator +=(double n)
 {
   c_ += n;
   return *this;
 }
 
-const MIPSolver::Expression &MIPSolver::Expression::operator -=(double n)
+MIPSolver::Expression &MIPSolver::Expression::operator -=(double n)
 {
   return *this += -n;
 }
 
-const MIPSolver::Expression &MIPSolver::Expression::operator *=(double n)
+MIPSolver::Expression &MIPSolver::Expression::operator *=(double n)
 {
+  if (n == 0)
+  {
+    f_.clear();
+  }
+
   for (auto it = f_.begin(); it != f_.end(); it++)
   {
-    f_[it->first] *= n;
+    it->second *= n;
   }
   c_ *= n;
   return *this;
 }
 
-const MIPSolver::Expression &MIPSolver::Expression::operator /=(double n)
+MIPSolver::Expression &MIPSolver::Expression::operator /=(double n)
 {
   for (auto it = f_.begin(); it != f_.end(); it++)
   {
-    f_[it->first] /= n;
+    it->second /= n;
   }
   c_ /= n;
   return *this;
 }
 
-MIPSolver::Condition MIPSolver::Expression::operator <=(const Expression &expr) const
+MIPSolver::Condition MIPSolver::Expression::operator <=(const Expression &expr) const &
+{
+  return std::move(Condition(*this - expr, lessOrEqual));
+}
+
+MIPSolver::Condition MIPSolver::Expression::operator <=(const Expression &expr) &&
+{
+  return std::move(Condition(std::move(*this -= expr), lessOrEqual));
+}
+
+MIPSolver::Condition MIPSolver::Expression::operator >=(const Expression &expr) const &
 {
-  return std::move(Condition(*this - expr, GLP_UP));
+  return std::move(Condition(*this - expr, greaterOrEqual));
 }
 
-MIPSolver::Condition MIPSolver::Expression::operator >=(const Expression &expr) const
+MIPSolver::Condition MIPSolver::Expression::operator >=(const Expression &expr) &&
 {
-  return std::move(Condition(*this - expr, GLP_LO));
+  return std::move(Condition(std::move(*this -= expr), greaterOrEqual));
 }
 
-MIPSolver::Condition MIPSolver::Expression::operator ==(const Expression &expr) const
+MIPSolver::Condition MIPSolver::Expression::operator ==(const Expression &expr) const &
 {
-  return std::move(Condition(*this - expr, GLP_FX));
+  return std::move(Condition(*this - expr, equal));
+}
+
+MIPSolver::Condition MIPSolver::Expression::operator ==(const Expression &expr) &&
+{
+  return std::move(Condition(std::move(*this -= expr), equal));
+}
+
+void MIPSolver::Expression::Add(const Expression &expr, double k)
+{
+  const Factors &f = expr.f_;
+  c_ += expr.c_ * k;
+
+  if (f.empty())
+  {
+    return;
+  }
+
+  // Newly created variables have the largest indices, so appending is the common case
+  if (f_.empty() || f_.back().first < f.front().first)
+  {
+    size_t n = f_.size();
+    f_.insert(f_.end(), f.begin(), f.end());
+    if (k != 1)
+    {
+      for (size_t i = n; i < f_.size(); i++)
+      {
+        f_[i].second *= k;
+      }
+    }
+    return;
+  }
+
+  Factors res;
+  res.reserve(f_.size() + f.size());
+
+  auto a = f_.cbegin();
+  auto b = f.cbegin();
+  while (a != f_.cend() || b != f.cend())
+  {
+    if (b == f.cend() || (a != f_.cend() && a->first < b->first))
+    {
+      res.push_back(*a++);
+    }
+    else if (a == f_.cend() || b->first < a->first)
+    {
+      res.push_back(Factor(b->first, b->second * k));
+      b++;
+    }
+    else
+    {
+      double v = a->second + b->second * k;
+      if (v != 0) res.push_back(Factor(a->first, v));
+      a++;
+      b++;
+    }
+  }
+
+  f_.swap(res);
 }
 
 MIPSolver::Expression operator +(double n, const MIPSolver::Expression &expr)
@@ -512,30 +1234,48 @@ MIPSolver::Expression operator +(double n, const MIPSolver::Expression &expr)
   return expr + n;
 }
 
+MIPSolver::Expression operator +(double n, MIPSolver::Expression &&expr)
+{
+  return std::move(expr) + n;
+}
+
 MIPSolver::Expression operator -(double n, const MIPSolver::Expression &expr)
 {
   return -expr + n;
 }
 
+MIPSolver::Expression operator -(double n, MIPSolver::Expression &&expr)
+{
+  return -std::move(expr) + n;
+}
+
 MIPSolver::Expression operator *(double n, const MIPSolver::Expression &expr)
 {
   return expr * n;
 }
 
+MIPSolver::Expression operator *(double n, MIPSolver::Expression &&expr)
+{
+  return std::move(expr) * n;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 double MIPSolver::Solution::operator ()(const Expression &expr) const
 {
-  double res = expr.GetC();
+  return MIPSolver::Evaluate(expr, x_);
+}
 
-  const Expression::FactorMap &f = expr.GetFactors();
-  for (auto it = f.begin(); it != f.end(); it++)
-  {
-    assert(it->first < x_.size());
-    res += x_[it->first] * it->second;
-  }
+void MIPSolver::Proposal::Set(const Variable &var, double value)
+{
+  size_t i = MIPSolver::GetIndex(var);
+  assert(i < x_.size());
+  x_[i] = value;
+}
 
-  return res;
+double MIPSolver::Proposal::operator ()(const Expression &expr) const
+{
+  return MIPSolver::Evaluate(expr, x_);
 }
 
 #ifdef _DEBUG
@@ -551,13 +1291,41 @@ void MIPSolver::Solution::Dump() const
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+MIPSolver::RefPoints::RefPoints(double absoluteTolerance, double relativeTolerance)
+  : absoluteTolerance_(absoluteTolerance), relativeTolerance_(relativeTolerance)
+{
+  assert(absoluteTolerance >= 0);
+  assert(relativeTolerance >= 0);
+}
+
+double MIPSolver::RefPoints::GetTolerance(double x) const
+{
+  return std::max(absoluteTolerance_, relativeTolerance_ * fabs(x));
+}
+
 bool MIPSolver::RefPoints::insert(double x)
 {
-  const double precision = 1; // TODO: configure?
+  // Only the nearest points on both sides can be too close (or in the same bucket, which is an interval)
+  auto it = points_.lower_bound(x);
+  auto prev = it == points_.begin() ? points_.end() : std::prev(it);
 
-  Key key = static_cast<Key>(round(x * precision));
+  if (relativeTolerance_ == 0 && absoluteTolerance_ > 0)
+  {
+    double width = 2 * absoluteTolerance_;
+    double bucket = round(x / width);
+    if (it != points_.end() && round(it->first / width) == bucket) return false;
+    if (prev != points_.end() && round(prev->first / width) == bucket) return false;
+  }
+  else
+  {
+    double tolerance = GetTolerance(x);
+    if (it != points_.end() && (it->first == x || it->first - x < tolerance)) return false;
+    if (prev != points_.end() && x - prev->first < tolerance) return false;
+  }
 
-  return points_.insert(std::make_pair(key, x)).second;
+  points_.insert(it, std::make_pair(x, x));
+  added_.push_back(x);
+  return true;
 }
 
 size_t MIPSolver::RefPoints::size()
@@ -579,3 +1347,26 @@ MIPSolver::RefPoints::Iterator MIPSolver::RefPoints::end()
 {
   return std::move(Iterator(points_.end()));
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool MIPSolver::Engine::ReportStatus(const MIPSolver &s, int activeNodes, double progress)
+{
+  return !s.callback_ || s.callback_(activeNodes, progress);
+}
+
+MIPSolver::Clock::time_point MIPSolver::Engine::GetDeadline(const MIPSolver &s, Clock::time_point start)
+{
+  if (s.options_.timeLimit <= 0)
+  {
+    return s.deadline_;
+  }
+
+  auto limit = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(s.options_.timeLimit));
+  return std::min(s.deadline_, start + limit);
+}
+
+double MIPSolver::Engine::GetGap(double value, double bound)
+{
+  return fabs(value - bound) / (fabs(value) + DBL_EPSILON);
+}
@@ -22,126 +22,386 @@
 
 #pragma once
 
+#include <chrono>
 #include <functional>
 #include <map>
+#include <memory>
 #include <set>
+#include <string>
+#include <utility>
 #include <vector>
 
+// Different solvers (copies too) can be used on different threads at the same time, one solver cannot.
+// A solver can move to another thread between calls, then its engine uploads the whole model again,
+// since GLPK problems belong to the thread that created them (and are released when that thread exits).
+// The status callback is called on the thread that optimizes.
 class MIPSolver
 {
 public:
   using StatusCallback = std::function<bool (int activeNodes, double progress)>;
 
   MIPSolver(StatusCallback &&callback = nullptr);
+  MIPSolver(const MIPSolver &s);
+  ~MIPSolver();
+
+  MIPSolver &operator =(const MIPSolver &s);
+
+  enum VariableType
+  {
+    continuous,
+    integer,
+    binary,
+  };
+
+  enum Relation
+  {
+    lessOrEqual,
+    greaterOrEqual,
+    equal,
+  };
+
+  // The model is solved by an engine selected by name, "GLPK" is the default one
+  class Engine;
+  static std::unique_ptr<Engine> CreateEngine(const std::string &name);
+  bool SetEngine(const std::string &name);
+
+  // Engines able to search in parallel use this many threads, zero means one per hardware thread
+  void SetThreads(size_t threads);
+
+  // An optimization reaching the deadline returns the best solution found so far, if any.
+  // An expired deadline does not start the engine at all, only the start is returned then.
+  using Clock = std::chrono::steady_clock;
+  void SetDeadline(Clock::time_point deadline);
+
+  // Tuning of the search, engines ignore the settings they do not support
+  struct Options
+  {
+    enum Branching
+    {
+      firstFractional,
+      lastFractional,
+      mostFractional,
+      driebeckTomlin,
+      pseudoCost,
+    };
+
+    enum Backtracking
+    {
+      depthFirst,
+      breadthFirst,
+      bestLocalBound,
+      bestProjection,
+    };
+
+    enum Preprocessing
+    {
+      noPreprocessing,
+      rootPreprocessing,
+      allPreprocessing,
+    };
+
+    Branching branching = driebeckTomlin;
+    Backtracking backtracking = bestLocalBound;
+    Preprocessing preprocessing = rootPreprocessing;
+
+    bool gomoryCuts = false;
+    bool mirCuts = false;
+    bool coverCuts = false;
+    bool cliqueCuts = false;
+
+    double mipGap = 0;    // Relative, the search stops as soon as the gap is not greater
+    double timeLimit = 0; // Seconds per optimization, zero means no limit
+    bool presolve = true; // Not applied to warm started optimizations
+    bool priorities = false; // Branching priorities of variables are followed (GLPK then runs without presolve)
+
+    // Reduces the model before passing it to the engine (which is then a new one, so nothing it has kept
+    // from previous optimizations is reused)
+    bool reduceModel = false;
+
+    bool scaleGeometric = false;
+    bool scaleEquilibrate = false;
+    bool scaleRoundToPowerOf2 = false;
+    bool scaleSkipIfWellScaled = false;
+    bool scaleAuto = false;
+  };
+
+  void SetOptions(const Options &options);
+  const Options &GetOptions() const;
+
+  enum Termination
+  {
+    finished,
+    timeout,
+    interrupted, // by the status callback
+  };
+
+  // Where the time of an optimization goes, times are in seconds
+  struct Statistics
+  {
+    double buildTime = 0;  // Since the solver was created, rolled back or last optimized, mostly spent on the model
+    double uploadTime = 0; // Preparing the model for the engine (including reduction) and passing it
+    double lpTime = 0;     // The LP relaxation of the root
+    double searchTime = 0; // Branch and bound
+
+    size_t nodes = 0;
+    size_t lpIterations = 0; // Of the simplex method
+    size_t cuts = 0;         // Rows added during the search
+    double gap = 0;
+
+    size_t variables = 0;
+    size_t conditions = 0;
+    size_t nonzeros = 0;
+
+    bool dumpFailed = false; // The model could not be written to the file of the model dump
+  };
 
   class Variable;
   Variable GetBinaryVariable();
   Variable GetIntegerVariable(double minValue, double maxValue);
   Variable GetIntegerVariable(double maxValue);
 
+  // If the options enable priorities, fractional variables of the highest priority (zero by default) are branched
+  // upon first. The first, the last or the most fractional one of them is chosen as the options say, other branching
+  // techniques fall back to the most fractional one. GLPK still applies any technique when the candidates tie
+  // in priority.
+  void SetBranchingPriority(const Variable &var, int priority);
+
+  // Returns the index of the condition, conditions are numbered in the order they are added
   class Condition;
-  void Restrict(const Condition &cond);
+  size_t Restrict(const Condition &cond);
+
+  // Conditions and bounds of variables can be changed in place between optimizations (when their coefficients
+  // depend on data that changes but the structure of the model does not), the engine keeps its problem and
+  // updates only them. The bounds of a binary stay within zero and one.
+  void Replace(size_t index, const Condition &cond);
+  void SetBounds(const Variable &var, double minValue, double maxValue);
+
+  // A lazy condition is left out of relaxations until their solutions violate it, which keeps them small when
+  // few of many conditions are ever binding. Engines add the violated ones during the search.
+  void RestrictLazily(const Condition &cond);
 
   struct Checkpoint;
   Checkpoint CreateCheckpoint() const;
   void Rollback(const Checkpoint &cp);
 
+  // The segment encoding creates a binary per segment, the logarithmic one only a logarithm of their count.
+  // The convex encoding creates no binaries, but its value may be greater than the exact one, so it is only
+  // valid for convex minimization: where the result is minimized or bounded from above.
+  enum Encoding
+  {
+    segmentEncoding,
+    logarithmicEncoding,
+    convexEncoding,
+  };
+
   class Expression;
-  Expression GetAbsoluteValue(const Expression &expr);
+  Expression GetAbsoluteValue(const Expression &expr, Encoding encoding = segmentEncoding);
+
+  // The exact square is convex, so like the convex encoding it is only valid where the result is minimized.
+  // Engines add tangents at the points where their relaxations underestimate it (lazily, during the search).
+  Expression GetSquare(const Expression &expr);
 
   class RefPoints;
-  Expression GetSquareApproximation(const Expression &expr, RefPoints &refpoints);
+  Expression GetSquareApproximation(const Expression &expr, RefPoints &refpoints, Encoding encoding = segmentEncoding);
 
+  // Adds the tangents at the refpoints inserted since the approximation was created or last refined, and returns
+  // the refined one. Nothing is recreated, so the cost is proportional to the new refpoints, but the refined
+  // approximation is only valid where it is minimized (like the convex encoding).
+  Expression RefineSquareApproximation(const Expression &approximation, const Expression &expr, RefPoints &refpoints);
+
+  // Each optimization writes its model with the minimized objective in the free MPS format to the file named
+  // by the callback, nothing is written for an empty name. Squares are written only with their initial tangents.
+  using ModelDump = std::function<std::string ()>;
+  void SetModelDump(ModelDump &&dump);
+
+  // Appends the model of an MPS file (e.g. a dumped one), returns false if the file cannot be read
+  bool LoadModel(const std::string &file, Expression &objective);
+
+  // A feasible start (e.g. the previous solution of a refined model) is passed to GLPK as the first incumbent.
+  // Variables created after the start was found are derived from it if they came from GetAbsoluteValue or
+  // GetSquareApproximation; otherwise, or if the result is infeasible, the start is ignored.
   class Solution;
   Solution Minimize(const Expression &expr);
+  Solution Minimize(const Expression &expr, const Solution &start);
   Solution Maximize(const Expression &expr);
+  Solution Maximize(const Expression &expr, const Solution &start);
+
+  // Minimizes the objectives one by one, each within its absolute tolerance (zero by default) of its optimum
+  // while the next ones are minimized. Every level starts from the previous solution with the model and the
+  // engine state kept (the first one from the start, if any), the level restrictions are removed afterwards.
+  // A level stopped early is the last one.
+  Solution MinimizeLexicographic(const std::vector<Expression> &objectives, const std::vector<double> &tolerances = {});
+
+  // Each objective can also be built right before its level is solved, when the previous levels are already fixed,
+  // so that the earlier levels do not carry its variables and conditions. Everything the builders add is removed
+  // afterwards with the level restrictions.
+  using Objective = std::function<Expression ()>;
+  Solution MinimizeLexicographic(const std::vector<Objective> &objectives, const std::vector<double> &tolerances,
+    const Solution &start);
+
+  // Up to count next best solutions of the minimized expression, ranked, which differ from the given one and from
+  // each other in at least one of the indicators: binaries or other expressions that can only be zero or one (like
+  // sums of exclusive binaries). Each one cuts the previous ones off and reuses the engine state.
+  std::vector<Solution> FindAlternatives(const Expression &expr, const Solution &sol,
+    const std::vector<Expression> &indicators, size_t count);
+
+  // A heuristic turns LP relaxations of branch and bound subproblems into solutions, so that the search can prune
+  // before it finds good ones itself. It gets the relaxation (which may be fractional) and decides the values of
+  // variables, others keep their relaxed values except for those derived like in a start (see Minimize). Proposals
+  // that are still infeasible are ignored. Only GLPK calls it, on the optimizing thread, and only for its own model.
+  class Proposal;
+  using Heuristic = std::function<bool (const Solution &relaxation, Proposal &proposal)>;
+  void SetHeuristic(Heuristic &&heuristic);
 
 #ifdef _DEBUG
   void Dump() const;
 #endif
 
 private:
+  using Vector = std::vector<double>;
+
   static double SignedFloor(double x);
+  static double Evaluate(const Expression &expr, const Vector &x);
+  static bool IsSatisfied(const Condition &cond, const Vector &x);
+  static size_t GetIndex(const Variable &var);
+  static double GetSeconds(Clock::time_point from, Clock::time_point to);
 
   void GetExpressionBounds(const Expression &expr, double &minValue, double &maxValue);
 
   Variable CreateBinaryVariable();
   Variable CreateIntegerVariable(double minValue, double maxValue);
   Variable CreateContinuousVariable(double minValue, double maxValue);
-  Variable CreateVariable(int type, double minValue, double maxValue);
+  Variable CreateVariable(VariableType type, double minValue, double maxValue);
 
   void AddCondition(const Condition &cond);
 
-  Solution Optimize(const Expression &expr);
+  Expression GetLogarithmicApproximation(const Expression &expr, const Vector &bx, const Vector &by);
+  Expression GetConvexApproximation(const Expression &expr, RefPoints &points, const Vector &by);
 
-  template<class T>
-  void GlpkCallback(T *tree) const;
+  void AddAuxiliary(size_t firstVar, std::function<void (Vector &x)> &&fill);
+  bool CompleteSolution(const Solution &start, Vector &x) const;
+  bool IsFeasible(const Vector &x) const;
+
+  // Asks the heuristic for a solution derived from the relaxation, false if it has none
+  bool Propose(const Vector &relaxation, Vector &x) const;
+
+  Solution Optimize(const Expression &expr, const Solution &start);
+
+  class Presolver;
 
 private:
   struct VariableInfo
   {
-    int type;
+    VariableType type;
     double min;
     double max;
+    size_t serial;
+    int priority;
+  };
+
+  // Derives values of the variables created by GetAbsoluteValue or GetSquareApproximation
+  struct Auxiliary
+  {
+    size_t var;
+    std::function<void (Vector &x)> fill;
   };
 
   std::vector<VariableInfo> vars_;
   std::vector<Condition> conds_;
+  std::vector<Condition> lazy_;
+  std::vector<Auxiliary> auxs_;
 
-  StatusCallback callback_;
+  // The variable is not less than the square of the expression (its factors are as in Expression)
+  struct Square
+  {
+    size_t var;
+    std::vector<std::pair<size_t, double>> factors;
+    double c;
+  };
+
+  std::vector<Square> squares_;
+  size_t created_ = 0;
 
-  template<class T>
-  friend void GlpkCallbackHelper(T *tree, void *param);
+  std::unique_ptr<Engine> engine_;
+  size_t threads_ = 1;
+  Options options_;
+  Clock::time_point deadline_ = Clock::time_point::max();
+  StatusCallback callback_;
+  ModelDump dump_;
+  Heuristic heuristic_;
+  const Presolver *presolver_ = nullptr; // Of a reduced model, which proposes solutions through its source
+  Clock::time_point built_ = Clock::now();
 };
 
 class MIPSolver::Expression
 {
 public:
   using Condition = MIPSolver::Condition;
-  using FactorMap = std::map<size_t, double>;
-
-  Expression(double c = 0) : c_(c) { }
-
-  Expression operator -() const;
-
-  Expression operator +(const Expression &expr) const;
-  Expression operator -(const Expression &expr) const;
 
-  Expression operator +(double n) const;
-  Expression operator -(double n) const;
-  Expression operator *(double n) const;
-  Expression operator /(double n) const;
+  // Sorted by variable index, without duplicates
+  using Factor = std::pair<size_t, double>;
+  using Factors = std::vector<Factor>;
 
-  const Expression &operator +=(const Expression &expr);
-  const Expression &operator -=(const Expression &expr);
-
-  const Expression &operator +=(double n);
-  const Expression &operator -=(double n);
-  const Expression &operator *=(double n);
-  const Expression &operator /=(double n);
-
-  Condition operator <=(const Expression &expr) const;
-  Condition operator >=(const Expression &expr) const;
-  Condition operator ==(const Expression &expr) const;
+  Expression(double c = 0) : c_(c) { }
 
-  const FactorMap &GetFactors() const { return f_; }
+  // Operations on temporaries reuse their storage
+  Expression operator -() const &;
+  Expression operator -() &&;
+
+  Expression operator +(const Expression &expr) const &;
+  Expression operator +(const Expression &expr) &&;
+  Expression operator +(Expression &&expr) const &;
+  Expression operator +(Expression &&expr) &&;
+
+  Expression operator -(const Expression &expr) const &;
+  Expression operator -(const Expression &expr) &&;
+  Expression operator -(Expression &&expr) const &;
+  Expression operator -(Expression &&expr) &&;
+
+  Expression operator +(double n) const &;
+  Expression operator +(double n) &&;
+  Expression operator -(double n) const &;
+  Expression operator -(double n) &&;
+  Expression operator *(double n) const &;
+  Expression operator *(double n) &&;
+  Expression operator /(double n) const &;
+  Expression operator /(double n) &&;
+
+  Expression &operator +=(const Expression &expr);
+  Expression &operator -=(const Expression &expr);
+
+  Expression &operator +=(double n);
+  Expression &operator -=(double n);
+  Expression &operator *=(double n);
+  Expression &operator /=(double n);
+
+  Condition operator <=(const Expression &expr) const &;
+  Condition operator <=(const Expression &expr) &&;
+  Condition operator >=(const Expression &expr) const &;
+  Condition operator >=(const Expression &expr) &&;
+  Condition operator ==(const Expression &expr) const &;
+  Condition operator ==(const Expression &expr) &&;
+
+  const Factors &GetFactors() const { return f_; }
   double GetC() const { return c_; }
 
 protected:
-  Expression(const MIPSolver &, size_t index)
-  {
-    f_[index] = 1;
-    c_ = 0;
-  }
+  Expression(const MIPSolver &, size_t index) : f_(1, Factor(index, 1)), c_(0) { }
 
 private:
-  FactorMap f_;
+  void Add(const Expression &expr, double k);
+
+private:
+  Factors f_;
   double c_;
 };
 
 MIPSolver::Expression operator +(double n, const MIPSolver::Expression &expr);
+MIPSolver::Expression operator +(double n, MIPSolver::Expression &&expr);
 MIPSolver::Expression operator -(double n, const MIPSolver::Expression &expr);
+MIPSolver::Expression operator -(double n, MIPSolver::Expression &&expr);
 MIPSolver::Expression operator *(double n, const MIPSolver::Expression &expr);
+MIPSolver::Expression operator *(double n, MIPSolver::Expression &&expr);
 
 class MIPSolver::Variable : public MIPSolver::Expression
 {
@@ -159,15 +419,18 @@ class MIPSolver::Condition
 public:
   using Expression = MIPSolver::Expression;
 
+  using Relation = MIPSolver::Relation;
+
   const Expression &GetExpression() const { return expr_; }
-  int GetRelation() const { return relation_; }
+  Relation GetRelation() const { return relation_; }
 
 private:
-  Condition(const Expression &expr, int relation) : expr_(expr), relation_(relation) { }
+  Condition(const Expression &expr, Relation relation) : expr_(expr), relation_(relation) { }
+  Condition(Expression &&expr, Relation relation) : expr_(std::move(expr)), relation_(relation) { }
 
 private:
   Expression expr_;
-  int relation_;
+  Relation relation_;
 
   friend class MIPSolver::Expression;
 };
@@ -177,6 +440,7 @@ struct MIPSolver::Checkpoint
 private:
   size_t vars;
   size_t conds;
+  size_t lazy;
 
   friend class MIPSolver;
 };
@@ -191,6 +455,14 @@ public:
   explicit operator bool() const { return !x_.empty(); }
   double operator ()(const Expression &expr) const;
 
+  // A solution may be feasible but not proven to be optimal if the optimization has been stopped early,
+  // the gap is relative to the objective value and is infinite when there is no bound
+  bool IsOptimal() const { return optimal_; }
+  double GetGap() const { return gap_; }
+  Termination GetTermination() const { return termination_; }
+  size_t GetNodeCount() const { return statistics_.nodes; }
+  const Statistics &GetStatistics() const { return statistics_; }
+
 #ifdef _DEBUG
   void Dump() const;
 #endif
@@ -198,7 +470,34 @@ public:
 private:
   using Vector = std::vector<double>;
 
-  Solution(const Vector &x) : x_(x) { }
+  Solution(const Vector &x, size_t created) : x_(x), created_(created) { }
+
+private:
+  Vector x_;
+  size_t created_ = 0;
+
+  bool optimal_ = false;
+  double gap_ = 0;
+  Termination termination_ = finished;
+  Statistics statistics_;
+
+  friend class MIPSolver;
+};
+
+class MIPSolver::Proposal
+{
+public:
+  using Expression = MIPSolver::Expression;
+  using Variable = MIPSolver::Variable;
+
+  // Integer variables are rounded
+  void Set(const Variable &var, double value);
+  double operator ()(const Expression &expr) const;
+
+private:
+  using Vector = std::vector<double>;
+
+  Proposal(const Vector &x) : x_(x) { }
 
 private:
   Vector x_;
@@ -209,6 +508,15 @@ private:
 class MIPSolver::RefPoints
 {
 public:
+  // Without a relative tolerance, points are merged by rounding them to multiples of twice the absolute one
+  // (to whole numbers by default), so a point that is not inserted is less than twice the tolerance away from
+  // one that is. Otherwise a point closer to an existing one than the tolerance (the greater of the absolute one
+  // and the relative one of its magnitude) is not inserted. The approximation errs at most by the square of that
+  // distance.
+  explicit RefPoints(double absoluteTolerance = 0.5, double relativeTolerance = 0);
+
+  double GetTolerance(double x) const;
+
   bool insert(double x);
   size_t size();
   bool empty();
@@ -218,10 +526,14 @@ public:
   Iterator end();
 
 private:
-  using Key = int64_t;
-  using Map = std::map<Key, double>;
+  using Map = std::map<double, double>;
 
+  double absoluteTolerance_;
+  double relativeTolerance_;
   Map points_;
+  std::vector<double> added_; // Not approximated yet
+
+  friend class MIPSolver;
 };
 
 class MIPSolver::RefPoints::Iterator : public Map::iterator
@@ -22,8 +22,16 @@
 
 #include "optimizer.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <deque>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <thread>
 
 Optimizer::Optimizer(StatusCallback &&callback) : callback_(callback)
 {
@@ -32,10 +40,47 @@ Optimizer::Optimizer(StatusCallback &&callback) : callback_(callback)
   cashResult_.commission = 0;
 }
 
+Optimizer::Model::Model(Optimizer *owner, const Allocation &allocation) :
+  owner(owner), allocation(allocation),
+  s(owner->callback_ ? [this](int activeNodes, double progress) -> bool
+  {
+    return this->owner->callback_(this->owner->iteration_, activeNodes, progress);
+  } : MIPSolver::StatusCallback())
+{
+}
+
 bool Optimizer::Optimize(const Allocation &allocation, const RatesProvider &f)
 {
-  std::vector<double> bid(allocation.GetCount());
-  std::vector<double> ask(allocation.GetCount());
+  Rates bid;
+  Rates ask;
+  ReadRates(allocation, f, bid, ask);
+
+  CompileModel(allocation, bid, ask);
+  return Solve(bid, ask);
+}
+
+bool Optimizer::Reoptimize(const RatesProvider &f)
+{
+  assert(model_); // Only an optimized allocation can be optimized again
+
+  Rates bid;
+  Rates ask;
+  ReadRates(model_->allocation, f, bid, ask);
+
+  // Assets that can be bought now but could not before (or the other way round) change the deals
+  if (!UpdateModel(bid, ask))
+  {
+    Allocation allocation = model_->allocation;
+    CompileModel(allocation, bid, ask);
+  }
+
+  return Solve(bid, ask);
+}
+
+void Optimizer::ReadRates(const Allocation &allocation, const RatesProvider &f, Rates &bid, Rates &ask)
+{
+  bid.resize(allocation.GetCount());
+  ask.resize(allocation.GetCount());
 
   for (size_t i = 0; i < allocation.GetCount(); i++)
   {
@@ -46,7 +91,163 @@ bool Optimizer::Optimize(const Allocation &allocation, const RatesProvider &f)
 
     assert(ask[i] >= bid[i]);
   }
+}
+
+double Optimizer::GetUpperBound(const Allocation &allocation, const Rates &bid)
+{
+  // Upper estimation
+  double upperBound = allocation.GetExistingCash();
+  for (size_t i = 0; i < allocation.GetCount(); i++)
+  {
+    upperBound += allocation.GetExistingShares(i) * bid[i];
+  }
+  return upperBound;
+}
+
+double Optimizer::GetMaxBuyVolume(const Allocation &allocation, size_t i, double upperBound, const Rates &bid,
+  const Rates &ask)
+{
+  // Upper estimation
+  return floor((upperBound - allocation.GetExistingShares(i) * bid[i]) / ask[i]);
+}
+
+void Optimizer::CompileModel(const Allocation &allocation, const Rates &bid, const Rates &ask)
+{
+  model_.reset(new Model(this, allocation));
+  MIPSolver &s = model_->s;
+
+  bool ok = s.SetEngine(allocation.GetSolverName());
+  assert(ok); // The caller should check the solver name
+  s.SetThreads(allocation.GetThreads());
+  s.SetOptions(allocation.GetSolverOptions());
+
+  // The directory is the one of the optimization that writes the model
+  Model *m = model_.get();
+  size_t sequence = 0;
+  s.SetModelDump([m, sequence]() mutable -> std::string
+  {
+    if (m->owner->dumpDirectory_.empty()) return std::string();
+
+    std::ostringstream name;
+    name << m->owner->dumpDirectory_ << "/model-" << std::setw(3) << std::setfill('0') << sequence++ << "-"
+      << m->owner->iteration_ << ".mps";
+    return name.str();
+  });
+
+  double upperBound = GetUpperBound(allocation, bid);
+
+  MIPSolver::Expression totalDeals;
+  Trades &trades = model_->trades;
+  trades.resize(allocation.GetCount());
+  model_->buyLimits.assign(allocation.GetCount(), 0);
+
+  for (size_t i = 0; i < allocation.GetCount(); i++)
+  {
+    double exists = allocation.GetExistingShares(i);
+
+    Trade &t = trades[i];
+    t.exists = exists;
+
+    MIPSolver::Expression allDeals;
+
+    if (allocation.CanBuy(i))
+    {
+      double maxBuyVol = GetMaxBuyVolume(allocation, i, upperBound, bid, ask);
+
+      if (maxBuyVol > 0)
+      {
+        // The volumes follow the decisions to trade, so those are branched upon first where priorities are enabled
+        t.buy = s.GetBinaryVariable();
+        s.SetBranchingPriority(t.buy, 1);
+        allDeals += t.buy;
+
+        t.buyVol = s.GetIntegerVariable(maxBuyVol);
+        s.Restrict(t.buyVol >= 1 * t.buy);
+        model_->buyLimits[i] = s.Restrict(t.buyVol <= maxBuyVol * t.buy);
+        t.maxBuyVol = maxBuyVol;
+      }
+    }
+
+    if (allocation.CanSell(i) && exists > 0)
+    {
+      t.sellAll = s.GetBinaryVariable();
+      s.SetBranchingPriority(t.sellAll, 1);
+      allDeals += t.sellAll;
+
+      double maxSellVol = floor(exists);
+      if (maxSellVol != exists) maxSellVol--;
+
+      if (maxSellVol > 1)
+      {
+        assert(maxSellVol >= 2);
+        t.sell = s.GetBinaryVariable();
+        s.SetBranchingPriority(t.sell, 1);
+        allDeals += t.sell;
+
+        t.sellVol = s.GetIntegerVariable(maxSellVol);
+        s.Restrict(t.sellVol >= 1 * t.sell);
+        s.Restrict(t.sellVol <= maxSellVol * t.sell);
+        t.maxSellVol = maxSellVol;
+      }
+    }
+
+    totalDeals += allDeals;
+    s.Restrict(allDeals <= 1);
+  }
 
+  if (allocation.GetMaxDeals() > 0)
+  {
+    s.Restrict(totalDeals <= static_cast<double>(allocation.GetMaxDeals()));
+  }
+
+  model_->rated = s.CreateCheckpoint();
+}
+
+bool Optimizer::UpdateModel(const Rates &bid, const Rates &ask)
+{
+  const Allocation &allocation = model_->allocation;
+  MIPSolver &s = model_->s;
+  Trades &trades = model_->trades;
+
+  auto created = [](const MIPSolver::Variable &var) { return !var.GetFactors().empty(); };
+
+  double upperBound = GetUpperBound(allocation, bid);
+  std::vector<double> maxBuyVol(allocation.GetCount(), 0);
+  for (size_t i = 0; i < allocation.GetCount(); i++)
+  {
+    if (allocation.CanBuy(i))
+    {
+      maxBuyVol[i] = GetMaxBuyVolume(allocation, i, upperBound, bid, ask);
+    }
+
+    if ((maxBuyVol[i] > 0) != created(trades[i].buy)) return false;
+  }
+
+  s.Rollback(model_->rated);
+
+  // Only these rows and columns of the engine problem change, the rest of it and its basis are kept
+  for (size_t i = 0; i < allocation.GetCount(); i++)
+  {
+    Trade &t = trades[i];
+    if (created(t.buy) && maxBuyVol[i] != t.maxBuyVol)
+    {
+      s.SetBounds(t.buyVol, 0, maxBuyVol[i]);
+      s.Replace(model_->buyLimits[i], t.buyVol <= maxBuyVol[i] * t.buy);
+      t.maxBuyVol = maxBuyVol[i];
+    }
+  }
+
+  return true;
+}
+
+bool Optimizer::Solve(const Rates &bid, const Rates &ask)
+{
+  Model &m = *model_;
+  m.owner = this;
+
+  const Allocation &allocation = m.allocation;
+  MIPSolver &s = m.s;
+  Trades &trades = m.trades;
 
   result_.empty();
   for (size_t i = 0; i < allocation.GetCount(); i++)
@@ -67,88 +268,61 @@ bool Optimizer::Optimize(const Allocation &allocation, const RatesProvider &f)
 
   cashResult_.have   = allocation.GetExistingCash();
 
+  double upperBound = GetUpperBound(allocation, bid);
 
-  // Upper estimation
-  double upperBound = allocation.GetExistingCash();
-  for (size_t i = 0; i < allocation.GetCount(); i++)
-  {
-    upperBound += allocation.GetExistingShares(i) * bid[i];
-  }
-
-
-  auto callback = [&](int activeNodes, double progress) -> bool
-  {
-    assert(callback_);
-    return callback_(iteration_, activeNodes, progress);
-  };
 
-  MIPSolver s(callback_ ? callback : MIPSolver::StatusCallback());
+  // The deal variables are the compiled ones, everything that depends on the rates is built from them
+  auto created = [](const MIPSolver::Variable &var) { return !var.GetFactors().empty(); };
 
   std::vector<MIPSolver::Expression> count(allocation.GetCount());
   std::vector<MIPSolver::Expression> commission(allocation.GetCount());
   std::vector<MIPSolver::Expression> oneMore(allocation.GetCount());
 
-  MIPSolver::Expression totalDeals;
+  std::vector<MIPSolver::Expression> deals; // Whether an asset is bought or sold, alternatives differ in them
   MIPSolver::Expression cash = allocation.GetExistingCash();
 
   for (size_t i = 0; i < allocation.GetCount(); i++)
   {
-    double exists = allocation.GetExistingShares(i);
+    Trade &t = trades[i];
+    double exists = t.exists;
 
     count[i] = exists;
+    t.ask = ask[i];
 
     MIPSolver::Expression allDeals;
 
-    if (allocation.CanBuy(i))
+    if (created(t.buy))
     {
-      // Upper estimation
-      double maxBuyVol = floor((upperBound - allocation.GetExistingShares(i) * bid[i]) / ask[i]);
+      allDeals += t.buy;
+      deals.push_back(t.buy);
 
-      if (maxBuyVol > 0)
-      {
-        auto buy = s.GetBinaryVariable();
-        allDeals += buy;
-
-        auto buyVol = s.GetIntegerVariable(maxBuyVol);
-        s.Restrict(buyVol >=         1 * buy);
-        s.Restrict(buyVol <= maxBuyVol * buy);
-
-        count[i]   += buyVol;
-        cash       -= buyVol * ask[i];
-        oneMore[i] += buy    * ask[i];
-      }
+      count[i]   += t.buyVol;
+      cash       -= t.buyVol * ask[i];
+      oneMore[i] += t.buy    * ask[i];
     }
 
-    if (allocation.CanSell(i) && exists > 0)
+    if (created(t.sellAll))
     {
-      auto sellAll = s.GetBinaryVariable();
-      allDeals += sellAll;
+      allDeals += t.sellAll;
+      MIPSolver::Expression sold = t.sellAll;
 
-      count[i]   -= sellAll * exists;
-      cash       += sellAll * exists * bid[i];
-      oneMore[i] += sellAll * (exists * bid[i] - allocation.GetCommission(i));
+      count[i]   -= t.sellAll * exists;
+      cash       += t.sellAll * exists * bid[i];
+      oneMore[i] += t.sellAll * (exists * bid[i] - allocation.GetCommission(i));
 
-      double maxSellVol = floor(exists);
-      if (maxSellVol != exists) maxSellVol--;
-
-      if (maxSellVol > 1)
+      if (created(t.sell))
       {
-        assert(maxSellVol >= 2);
-        auto sell = s.GetBinaryVariable();
-        allDeals += sell;
+        allDeals += t.sell;
+        sold += t.sell;
 
-        auto sellVol = s.GetIntegerVariable(maxSellVol);
-        s.Restrict(sellVol >= 1 * sell);
-        s.Restrict(sellVol <= maxSellVol * sell);
-
-        count[i]   -= sellVol;
-        cash       += sellVol * bid[i];
-        oneMore[i] += sell    * bid[i];
+        count[i]   -= t.sellVol;
+        cash       += t.sellVol * bid[i];
+        oneMore[i] += t.sell    * bid[i];
       }
-    }
 
-    totalDeals += allDeals;
-    s.Restrict(allDeals <= 1);
+      // Both sales are deals of the asset, so only one of them is set
+      deals.push_back(sold);
+    }
 
     commission[i] = allocation.GetCommission(i) * allDeals;
     cash -= commission[i];
@@ -161,14 +335,10 @@ bool Optimizer::Optimize(const Allocation &allocation, const RatesProvider &f)
     {
       oneMore[i] += (1 - allDeals) * (upperBound + 0.01);
     }
-  }
 
-  if (allocation.GetMaxDeals() > 0)
-  {
-    s.Restrict(totalDeals <= static_cast<double>(allocation.GetMaxDeals()));
+    t.count = count[i];
   }
 
-
   MIPSolver::Expression volume;
   for (size_t i = 0; i < allocation.GetCount(); i++)
   {
@@ -218,13 +388,39 @@ bool Optimizer::Optimize(const Allocation &allocation, const RatesProvider &f)
   }
 
 
-  MIPSolver::Checkpoint cp = s.CreateCheckpoint();
-  s.Restrict(totalDeals == 0);
-  iteration_ = 0;
-  MIPSolver::Solution source = s.Minimize(0);
-  assert(source);
-  assert(source(cash) == allocation.GetExistingCash());
-  s.Rollback(cp);
+  // Nothing is traded at the source, where all the variables are zero, so the expressions are their constants
+  assert(cash.GetC() == allocation.GetExistingCash());
+  double sourceVolume = volume.GetC();
+  std::vector<double> sourceDiff(diff.size());
+  for (size_t i = 0; i < diff.size(); i++)
+  {
+    sourceDiff[i] = diff[i].GetC();
+  }
+
+  // Good plans found early let the search prune most of the tree, but GLPK then runs without its presolver
+  if (allocation.UseRoundingHeuristic())
+  {
+    size_t maxDeals = allocation.GetMaxDeals();
+    s.SetHeuristic([trades, cash, maxDeals](const MIPSolver::Solution &relaxation, MIPSolver::Proposal &proposal)
+    {
+      return RoundDeals(trades, cash, maxDeals, relaxation, proposal);
+    });
+  }
+
+  MIPSolver::Clock::time_point deadline = deadline_;
+  if (allocation.GetTimeLimit() > 0)
+  {
+    auto limit = std::chrono::duration<double>(allocation.GetTimeLimit());
+    deadline = std::min(deadline, MIPSolver::Clock::now() + std::chrono::duration_cast<MIPSolver::Clock::duration>(limit));
+  }
+  s.SetDeadline(deadline);
+
+  optimal_ = true;
+  gap_ = 0;
+  termination_ = MIPSolver::finished;
+  nodes_ = 0;
+  statistics_.clear();
+  convergence_.clear();
 
   s.Restrict(cash >= 0);
 
@@ -232,7 +428,8 @@ bool Optimizer::Optimize(const Allocation &allocation, const RatesProvider &f)
   {
     if (allocation.UseAllCash())
     {
-      s.Restrict(cash <= oneMore[i] - 0.01);
+      // Few of these are ever binding, and each one has all the deals of the asset and the whole cash
+      s.RestrictLazily(cash <= oneMore[i] - 0.01);
     }
     else if (allocation.IsTargetInPercents(i))
     {
@@ -242,16 +439,38 @@ bool Optimizer::Optimize(const Allocation &allocation, const RatesProvider &f)
   }
 
 
+  // The previous plan is only a start if it is still feasible at these rates
   MIPSolver::Solution sol;
-  if (allocation.UseLeastSquaresApproximation())
+  MIPSolver::Expression objective;
+  if (allocation.UseExactLeastSquares())
   {
-    sol = RunLsOptimization(s, diff);
+    sol = RunExactLsOptimization(s, diff, m.plan, objective);
+  }
+  else if (allocation.UseLeastSquaresApproximation())
+  {
+    sol = RunLsOptimization(s, diff, allocation, upperBound, m.plan, objective);
   }
   else
   {
-    sol = RunLadOptimization(s, diff);
+    sol = RunLadOptimization(s, diff, allocation.GetEncoding(), m.plan, objective);
   }
 
+  // Alternatives of an unfinished optimization would not be the next best ones
+  std::vector<MIPSolver::Solution> alternatives;
+  if (allocation.GetAlternatives() > 0 && sol && sol.GetTermination() == MIPSolver::finished)
+  {
+    alternatives = s.FindAlternatives(objective, sol, deals, allocation.GetAlternatives());
+    for (auto it = alternatives.begin(); it != alternatives.end(); it++)
+    {
+      // Only the result itself is proven to be optimal or not
+      nodes_ += it->GetNodeCount();
+      statistics_.push_back(it->GetStatistics());
+    }
+  }
+
+  // The next optimization at other rates starts from this plan
+  m.plan = sol;
+
 
   if (sol)
   {
@@ -282,7 +501,6 @@ bool Optimizer::Optimize(const Allocation &allocation, const RatesProvider &f)
   cashResult_.change = cashResult_.result - cashResult_.have;
 
 
-  double sourceVolume = source(volume);
   for (size_t i = 0; i < allocation.GetCount(); i++)
   {
     const std::string &ticker = allocation.GetTicker(i);
@@ -327,7 +545,7 @@ bool Optimizer::Optimize(const Allocation &allocation, const RatesProvider &f)
     }
   }
 
-  qsource_ = CalculateQuality(diff, source); // TODO: add tests
+  qsource_ = CalculateQuality(sourceDiff);
   if (sol)
   {
     qresult_ = CalculateQuality(diff, sol);
@@ -346,9 +564,184 @@ bool Optimizer::Optimize(const Allocation &allocation, const RatesProvider &f)
     qresult_ = qsource_;
   }
 
+  // Alternatives share the source part of the result
+  alternatives_.clear();
+  for (auto it = alternatives.begin(); it != alternatives.end(); it++)
+  {
+    const MIPSolver::Solution &alt = *it;
+    double volumeValue = alt(volume);
+
+    Alternative a;
+    a.result = result_;
+    for (size_t i = 0; i < allocation.GetCount(); i++)
+    {
+      Result &r = a.result[allocation.GetTicker(i)];
+      r.result     = alt(count[i]);
+      r.commission = alt(commission[i]);
+      r.change     = r.result - r.have;
+      r.percents   = r.inPercents && volumeValue > 0 ? 100 * r.result * bid[i] / volumeValue : 0;
+    }
+
+    a.cashResult = cashResult_;
+    a.cashResult.result   = alt(cash);
+    a.cashResult.change   = a.cashResult.result - a.cashResult.have;
+    a.cashResult.percents = a.cashResult.inPercents && volumeValue > 0 ? 100 * a.cashResult.result / volumeValue : 0;
+
+    a.quality = CalculateQuality(diff, alt);
+    alternatives_.push_back(std::move(a));
+  }
+
   return !!sol;
 }
 
+std::vector<Optimizer::BatchResult> Optimizer::OptimizeBatch(const std::vector<Allocation> &allocations,
+  const RatesProvider &f, size_t threads)
+{
+  // The provider may be user code that is not thread safe (or slow), so the workers share a snapshot
+  std::map<std::string, std::pair<double, double>> rates;
+  for (auto it = allocations.begin(); it != allocations.end(); it++)
+  {
+    for (size_t i = 0; i < it->GetCount(); i++)
+    {
+      const std::string &ticker = it->GetTicker(i);
+      if (rates.find(ticker) == rates.end())
+      {
+        std::pair<double, double> &r = rates[ticker];
+        f(ticker, r.first, r.second);
+      }
+    }
+  }
+
+  RatesProvider snapshot = [&rates](const std::string &ticker, double &bid, double &ask)
+  {
+    auto it = rates.find(ticker);
+    assert(it != rates.end());
+    bid = it->second.first;
+    ask = it->second.second;
+  };
+
+  if (threads == 0)
+  {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  threads = std::max<size_t>(std::min(threads, allocations.size()), 1);
+
+  // The biggest jobs go first, so that the last ones to finish are short
+  std::vector<size_t> order(allocations.size());
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&allocations](size_t a, size_t b)
+  {
+    return GetBatchSize(allocations[a]) > GetBatchSize(allocations[b]);
+  });
+
+  struct Worker
+  {
+    std::mutex mutex;
+    std::deque<size_t> jobs;
+  };
+
+  std::vector<Worker> workers(threads);
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    workers[i % threads].jobs.push_back(order[i]);
+  }
+
+  std::vector<BatchResult> results(allocations.size());
+  auto work = [&](size_t index)
+  {
+    for (;;)
+    {
+      // The own jobs are taken from the front (the biggest ones), the ones of others from the back
+      size_t job = allocations.size();
+      for (size_t i = 0; i < workers.size() && job == allocations.size(); i++)
+      {
+        Worker &w = workers[(index + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (!w.jobs.empty())
+        {
+          job = i == 0 ? w.jobs.front() : w.jobs.back();
+          if (i == 0) w.jobs.pop_front(); else w.jobs.pop_back();
+        }
+      }
+
+      // Jobs are never added, so nothing is left anywhere
+      if (job == allocations.size()) break;
+
+      BatchResult &r = results[job];
+      MIPSolver::Clock::time_point started = MIPSolver::Clock::now();
+      r.ok = r.optimizer.Optimize(allocations[job], snapshot);
+      r.seconds = std::chrono::duration<double>(MIPSolver::Clock::now() - started).count();
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (size_t i = 0; i < threads; i++)
+  {
+    pool.push_back(std::thread(work, i));
+  }
+  for (auto it = pool.begin(); it != pool.end(); it++)
+  {
+    it->join();
+  }
+
+  return results;
+}
+
+size_t Optimizer::GetBatchSize(const Allocation &allocation)
+{
+  // Every possible deal is a binary of the model
+  size_t size = 0;
+  for (size_t i = 0; i < allocation.GetCount(); i++)
+  {
+    if (allocation.CanBuy(i)) size++;
+    if (allocation.CanSell(i) && allocation.GetExistingShares(i) > 0) size += 2;
+  }
+  return size;
+}
+
+void Optimizer::SetDeadline(MIPSolver::Clock::time_point deadline)
+{
+  deadline_ = deadline;
+}
+
+bool Optimizer::IsOptimal() const
+{
+  return optimal_;
+}
+
+double Optimizer::GetGap() const
+{
+  return gap_;
+}
+
+MIPSolver::Termination Optimizer::GetTermination() const
+{
+  return termination_;
+}
+
+size_t Optimizer::GetNodeCount() const
+{
+  return nodes_;
+}
+
+const std::vector<Optimizer::Convergence> &Optimizer::GetConvergence() const
+{
+  return convergence_;
+}
+
+const std::vector<MIPSolver::Statistics> &Optimizer::GetStatistics() const
+{
+  return statistics_;
+}
+
+void Optimizer::SetModelDump(const std::string &directory)
+{
+  dumpDirectory_ = directory;
+}
+
 const Optimizer::Result &Optimizer::GetResult(const std::string &ticker) const
 {
   auto it = result_.find(ticker);
@@ -371,89 +764,299 @@ const Optimizer::Quality &Optimizer::GetResultQuality() const
   return qresult_;
 }
 
-MIPSolver::Solution Optimizer::RunLadOptimization(MIPSolver &s, const Diffs &diff)
+size_t Optimizer::GetAlternativeCount() const
+{
+  return alternatives_.size();
+}
+
+const Optimizer::Result &Optimizer::GetAlternativeResult(size_t index, const std::string &ticker) const
+{
+  assert(index < alternatives_.size());
+  auto it = alternatives_[index].result.find(ticker);
+  assert(it != alternatives_[index].result.end());
+  return it->second;
+}
+
+const Optimizer::Result &Optimizer::GetAlternativeCashResult(size_t index) const
+{
+  assert(index < alternatives_.size());
+  return alternatives_[index].cashResult;
+}
+
+const Optimizer::Quality &Optimizer::GetAlternativeQuality(size_t index) const
+{
+  assert(index < alternatives_.size());
+  return alternatives_[index].quality;
+}
+
+MIPSolver::Solution Optimizer::RunLadOptimization(MIPSolver &s, const Diffs &diff, MIPSolver::Encoding encoding,
+    const MIPSolver::Solution &start, MIPSolver::Expression &objective)
 {
   Diffs abs(diff.size());
   MIPSolver::Expression sum;
   for (size_t i = 0; i < diff.size(); i++)
   {
-    abs[i] = s.GetAbsoluteValue(diff[i]);
+    abs[i] = s.GetAbsoluteValue(diff[i], encoding);
     sum += abs[i];
   }
 
-  iteration_ = 1;
-  MIPSolver::Solution sol = s.Minimize(sum);
-  if (sol)
+  auto first = [&]() -> MIPSolver::Expression
   {
-    s.Restrict(sum <= sol(sum));
+    iteration_ = 1;
+    return sum;
+  };
+
+  // Built once the sum is fixed at its minimum, so the first level does not carry these terms, and the convex
+  // encoding cannot overestimate the absolute values
+  auto second = [&]() -> MIPSolver::Expression
+  {
+    iteration_ = 2;
     MIPSolver::Expression avg = sum / static_cast<double>(diff.size());
 
     MIPSolver::Expression var;
     for (size_t i = 0; i < diff.size(); i++)
     {
-      var += s.GetAbsoluteValue(abs[i] - avg);
+      var += s.GetAbsoluteValue(abs[i] - avg, encoding);
     }
+    return var;
+  };
 
-    iteration_ = 2;
-    sol = s.Minimize(var);
-    assert(sol);
-  }
+  MIPSolver::Solution sol = s.MinimizeLexicographic({ first, second }, {}, start);
+  objective = sum;
+  TrackStatus(sol);
 
   return std::move(sol);
 }
 
-MIPSolver::Solution Optimizer::RunLsOptimization(MIPSolver &s, const Diffs &diff)
+MIPSolver::Solution Optimizer::RunLsOptimization(MIPSolver &s, const Diffs &diff, const Allocation &allocation, double scale,
+    const MIPSolver::Solution &start, MIPSolver::Expression &objective)
 {
-  MIPSolver::Checkpoint cp = s.CreateCheckpoint();
+  MIPSolver::RefPoints empty(allocation.GetRefPointTolerance(), allocation.GetRelativeRefPointTolerance());
+  std::vector<MIPSolver::RefPoints> refpoints(diff.size(), empty);
 
-  std::vector<MIPSolver::RefPoints> refpoints(diff.size());
+  // Deviations of any size up to the whole portfolio are approximated well enough from the first pass,
+  // which saves the passes that would otherwise add these points one by one
+  if (allocation.UseMultiscaleRefPoints())
+  {
+    for (size_t i = 0; i < diff.size(); i++)
+    {
+      refpoints[i].insert(0);
+      for (double t = scale; t > refpoints[i].GetTolerance(t) && t >= 0.01; t /= 4)
+      {
+        refpoints[i].insert(t);
+        refpoints[i].insert(-t);
+      }
+    }
+  }
 
-  MIPSolver::Solution sol;
+  Diffs squares(diff.size());
+  for (size_t i = 0; i < diff.size(); i++)
+  {
+    squares[i] = s.GetSquareApproximation(diff[i], refpoints[i], allocation.GetEncoding());
+  }
+
+  MIPSolver::Solution sol = start;
   for (iteration_ = 1;; iteration_++)
   {
     MIPSolver::Expression sum;
     for (size_t i = 0; i < diff.size(); i++)
     {
-      sum += s.GetSquareApproximation(diff[i], refpoints[i]);
+      sum += squares[i];
     }
 
-    sol = s.Minimize(sum);
+    // The previous answer is still feasible for the refined approximation (the first one starts from the given start)
+    sol = s.Minimize(sum, sol);
+    objective = sum;
     assert(iteration_ == 1 || sol);
-    if (!sol) break;
+    TrackStatus(sol);
+    if (!sol || sol.GetTermination() != MIPSolver::finished) break;
+
+    Convergence c;
+    c.approximation = sol(sum);
+    c.exact = 0;
+    c.refpoints = 0;
+    c.added = 0;
+    for (size_t i = 0; i < diff.size(); i++)
+    {
+      double v = sol(diff[i]);
+      c.exact += v * v;
+
+      if (refpoints[i].insert(v))
+      {
+        c.added++;
+      }
+      c.refpoints += refpoints[i].size();
+    }
+    convergence_.push_back(c);
 
-    bool done = true;
+    if (c.added == 0) break;
+    if (allocation.GetMaxIterations() > 0 && iteration_ >= allocation.GetMaxIterations()) break;
+
+    // Only the terms with new refpoints get new tangents, the model and the engine state are kept
     for (size_t i = 0; i < diff.size(); i++)
     {
-      if (refpoints[i].insert(sol(diff[i]))) done = false;
+      squares[i] = s.RefineSquareApproximation(squares[i], diff[i], refpoints[i]);
     }
-    if (done) break;
+  }
+
+  return std::move(sol);
+}
 
-    s.Rollback(cp);
+MIPSolver::Solution Optimizer::RunExactLsOptimization(MIPSolver &s, const Diffs &diff, const MIPSolver::Solution &start,
+    MIPSolver::Expression &objective)
+{
+  MIPSolver::Expression sum;
+  for (size_t i = 0; i < diff.size(); i++)
+  {
+    sum += s.GetSquare(diff[i]);
   }
 
+  // A single search, the engine refines the squares with tangents on its own
+  iteration_ = 1;
+  MIPSolver::Solution sol = s.Minimize(sum, start);
+  objective = sum;
+  TrackStatus(sol);
+
   return std::move(sol);
 }
 
 Optimizer::Quality Optimizer::CalculateQuality(const Diffs &diff, const MIPSolver::Solution &sol)
+{
+  std::vector<double> delta(diff.size());
+  for (size_t i = 0; i < diff.size(); i++)
+  {
+    delta[i] = sol(diff[i]);
+  }
+
+  return std::move(CalculateQuality(delta));
+}
+
+Optimizer::Quality Optimizer::CalculateQuality(const std::vector<double> &delta)
 {
   Quality q;
 
   q.abserr = 0;
   double sumsqr = 0;
 
-  for (size_t i = 0; i < diff.size(); i++)
+  for (size_t i = 0; i < delta.size(); i++)
   {
-    double delta = sol(diff[i]);
-
-    q.abserr += fabs(delta);
-    sumsqr += delta * delta;
+    q.abserr += fabs(delta[i]);
+    sumsqr += delta[i] * delta[i];
   }
 
-  q.abserr /= diff.size();
+  q.abserr /= delta.size();
 
-  q.stddev = sumsqr / diff.size();
+  q.stddev = sumsqr / delta.size();
   assert(q.stddev >= 0);
   q.stddev = sqrt(q.stddev);
 
   return std::move(q);
 }
+
+bool Optimizer::RoundDeals(const Trades &trades, const MIPSolver::Expression &cash, size_t maxDeals,
+  const MIPSolver::Solution &relaxation, MIPSolver::Proposal &proposal)
+{
+  auto exists = [](const MIPSolver::Variable &var) { return !var.GetFactors().empty(); };
+
+  // Relaxed changes of the assets, and their values to keep the biggest deals within the limit
+  std::vector<double> change(trades.size());
+  std::vector<std::pair<double, size_t>> deals;
+  for (size_t i = 0; i < trades.size(); i++)
+  {
+    const Trade &t = trades[i];
+    if (exists(t.buy))     { proposal.Set(t.buy, 0); proposal.Set(t.buyVol, 0); }
+    if (exists(t.sellAll)) { proposal.Set(t.sellAll, 0); }
+    if (exists(t.sell))    { proposal.Set(t.sell, 0); proposal.Set(t.sellVol, 0); }
+
+    change[i] = relaxation(t.count) - t.exists;
+    if (fabs(change[i]) >= 0.5)
+    {
+      deals.push_back(std::make_pair(fabs(change[i]) * t.ask, i));
+    }
+  }
+
+  std::sort(deals.begin(), deals.end(), std::greater<std::pair<double, size_t>>());
+  if (maxDeals > 0 && deals.size() > maxDeals)
+  {
+    deals.resize(maxDeals);
+  }
+
+  std::vector<size_t> buys;
+  for (auto it = deals.begin(); it != deals.end(); it++)
+  {
+    const Trade &t = trades[it->second];
+    double vol = floor(fabs(change[it->second]) + 0.5);
+
+    if (change[it->second] > 0 && exists(t.buy))
+    {
+      proposal.Set(t.buy, 1);
+      proposal.Set(t.buyVol, std::min(vol, t.maxBuyVol));
+      buys.push_back(it->second);
+    }
+    else if (change[it->second] < 0 && exists(t.sell) && vol <= t.maxSellVol)
+    {
+      proposal.Set(t.sell, 1);
+      proposal.Set(t.sellVol, vol);
+    }
+    else if (change[it->second] < 0 && exists(t.sellAll))
+    {
+      proposal.Set(t.sellAll, 1);
+    }
+  }
+
+  // Purchases rounded up the most give shares back until the cash is enough
+  double left = proposal(cash);
+  while (left < 0)
+  {
+    size_t best = trades.size();
+    double excess = -INFINITY;
+    for (auto it = buys.begin(); it != buys.end(); it++)
+    {
+      double e = proposal(trades[*it].buyVol) - change[*it];
+      if (proposal(trades[*it].buyVol) > 0 && e > excess)
+      {
+        best = *it;
+        excess = e;
+      }
+    }
+    if (best == trades.size()) return false;
+
+    const Trade &t = trades[best];
+    double vol = proposal(t.buyVol);
+    vol -= std::min(vol, ceil(-left / t.ask));
+    proposal.Set(t.buy, vol > 0 ? 1 : 0);
+    proposal.Set(t.buyVol, vol);
+    left = proposal(cash);
+  }
+
+  // The rest of the cash buys more of the shares rounded down the most
+  std::sort(buys.begin(), buys.end(), [&](size_t a, size_t b)
+  {
+    return change[a] - proposal(trades[a].buyVol) > change[b] - proposal(trades[b].buyVol);
+  });
+  for (auto it = buys.begin(); it != buys.end(); it++)
+  {
+    const Trade &t = trades[*it];
+    double vol = proposal(t.buyVol);
+    if (vol > 0 && vol < t.maxBuyVol && left >= t.ask)
+    {
+      proposal.Set(t.buyVol, vol + 1);
+      left = proposal(cash);
+    }
+  }
+
+  return true;
+}
+
+void Optimizer::TrackStatus(const MIPSolver::Solution &sol)
+{
+  nodes_ += sol.GetNodeCount();
+  statistics_.push_back(sol.GetStatistics());
+
+  if (optimal_ && !sol.IsOptimal())
+  {
+    optimal_ = false;
+    gap_ = sol ? sol.GetGap() : INFINITY;
+    termination_ = sol.GetTermination();
+  }
+}
@@ -27,8 +27,11 @@
 
 #include <functional>
 #include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
+// Like MIPSolver, different optimizers can be used on different threads at the same time
 class Optimizer
 {
 public:
@@ -39,6 +42,52 @@ public:
   using RatesProvider = std::function<void (const std::string &ticker, double &bid, double &ask)>;
   bool Optimize(const Allocation &allocation, const RatesProvider &f);
 
+  // Optimizes the last optimized allocation again at other rates. Its deals are not modeled again: only the volumes
+  // that can be bought change, in place, so the engine keeps most of its problem. The rest of the model depends on
+  // the rates and is rebuilt, the search starts from the previous plan if it is still feasible. If the assets that
+  // can be bought change, the allocation is optimized from scratch.
+  bool Reoptimize(const RatesProvider &f);
+
+  // Optimizes many allocations on a pool of threads (zero means one per hardware thread), the biggest ones first,
+  // idle threads take the rest from the busy ones. The rates of all tickers are read before that on this thread
+  // and shared by all optimizations. The results are in the order of the allocations.
+  struct BatchResult;
+  static std::vector<BatchResult> OptimizeBatch(const std::vector<Allocation> &allocations, const RatesProvider &f,
+    size_t threads = 0);
+
+  // The optimization returns the best result found by the deadline (or by the time limit of the allocation),
+  // the gap and the termination belong to the first optimization step that has not been proven optimal
+  // (which may also have finished within the MIP gap of the options)
+  void SetDeadline(MIPSolver::Clock::time_point deadline);
+  bool IsOptimal() const;
+  double GetGap() const;
+  MIPSolver::Termination GetTermination() const;
+
+  // Branch and bound subproblems solved by all optimization steps
+  size_t GetNodeCount() const;
+
+  // One per optimization step, the first one is of the first iteration (the source is not optimized),
+  // followed by one per alternative
+  const std::vector<MIPSolver::Statistics> &GetStatistics() const;
+
+  // One per iteration of the least squares approximation. The squares of the deviations of its result are
+  // the exact value, which is above the approximated one by at most the square of the distance between
+  // a deviation and its nearest refpoint (see MIPSolver::RefPoints) per deviation; the least squares optimum
+  // lies between them if the approximation has been solved to optimality.
+  // The refinement has converged when no refpoints are added.
+  struct Convergence
+  {
+    double approximation;
+    double exact;
+    size_t refpoints; // In all approximated terms
+    size_t added;
+  };
+
+  const std::vector<Convergence> &GetConvergence() const;
+
+  // Every solved model is written to the directory as model-<sequence>-<iteration>.mps
+  void SetModelDump(const std::string &directory);
+
   struct Result
   {
     std::string ticker;
@@ -68,12 +117,77 @@ public:
   const Quality &GetSourceQuality() const;
   const Quality &GetResultQuality() const;
 
+  // Plans with other deals, ranked by the optimized deviation, if the allocation asks for them
+  size_t GetAlternativeCount() const;
+  const Result &GetAlternativeResult(size_t index, const std::string &ticker) const;
+  const Result &GetAlternativeCashResult(size_t index) const;
+  const Quality &GetAlternativeQuality(size_t index) const;
+
 private:
   using Diffs = std::vector<MIPSolver::Expression>;
-  MIPSolver::Solution RunLadOptimization(MIPSolver &s, const Diffs &diff);
-  MIPSolver::Solution RunLsOptimization(MIPSolver &s, const Diffs &diff);
+  static size_t GetBatchSize(const Allocation &allocation);
+
+  using Rates = std::vector<double>;
+  static void ReadRates(const Allocation &allocation, const RatesProvider &f, Rates &bid, Rates &ask);
+  static double GetUpperBound(const Allocation &allocation, const Rates &bid);
+  static double GetMaxBuyVolume(const Allocation &allocation, size_t i, double upperBound, const Rates &bid,
+    const Rates &ask);
+
+  // Compiling creates the deal variables of the allocation, updating fails if the rates change which of them exist
+  void CompileModel(const Allocation &allocation, const Rates &bid, const Rates &ask);
+  bool UpdateModel(const Rates &bid, const Rates &ask);
+  bool Solve(const Rates &bid, const Rates &ask);
+
+  MIPSolver::Solution RunLadOptimization(MIPSolver &s, const Diffs &diff, MIPSolver::Encoding encoding,
+    const MIPSolver::Solution &start, MIPSolver::Expression &objective);
+  MIPSolver::Solution RunLsOptimization(MIPSolver &s, const Diffs &diff, const Allocation &allocation, double scale,
+    const MIPSolver::Solution &start, MIPSolver::Expression &objective);
+  MIPSolver::Solution RunExactLsOptimization(MIPSolver &s, const Diffs &diff, const MIPSolver::Solution &start,
+    MIPSolver::Expression &objective);
 
   Quality CalculateQuality(const Diffs &diff, const MIPSolver::Solution &sol);
+  Quality CalculateQuality(const std::vector<double> &delta);
+
+  // The deal variables of an asset, absent ones are empty expressions
+  struct Trade
+  {
+    double exists;
+    double ask;
+    MIPSolver::Expression count;
+
+    MIPSolver::Variable buy;
+    MIPSolver::Variable buyVol;
+    double maxBuyVol = 0;
+
+    MIPSolver::Variable sellAll;
+    MIPSolver::Variable sell;
+    MIPSolver::Variable sellVol;
+    double maxSellVol = 0;
+  };
+
+  using Trades = std::vector<Trade>;
+
+  // Rounds the relaxed deals to whole shares and repairs the cash greedily
+  static bool RoundDeals(const Trades &trades, const MIPSolver::Expression &cash, size_t maxDeals,
+    const MIPSolver::Solution &relaxation, MIPSolver::Proposal &proposal);
+
+  void TrackStatus(const MIPSolver::Solution &sol);
+
+  // The model of the last optimized allocation. Up to the checkpoint it has the deal variables and their conditions,
+  // which depend on the rates only through the volumes that can be bought; the rest is rebuilt by every optimization.
+  struct Model
+  {
+    Model(Optimizer *owner, const Allocation &allocation);
+
+    Optimizer *owner; // Which receives the status and names the dumps, it may have moved since the compilation
+    Allocation allocation;
+    MIPSolver s;
+
+    Trades trades;
+    std::vector<size_t> buyLimits; // Conditions limiting the bought volumes, by asset
+    MIPSolver::Checkpoint rated;
+    MIPSolver::Solution plan;      // The last result
+  };
 
 private:
   std::map<std::string, Result> result_;
@@ -82,6 +196,33 @@ private:
   Quality qsource_;
   Quality qresult_;
 
+  struct Alternative
+  {
+    std::map<std::string, Result> result;
+    Result cashResult;
+    Quality quality;
+  };
+
+  std::vector<Alternative> alternatives_;
+
+  MIPSolver::Clock::time_point deadline_ = MIPSolver::Clock::time_point::max();
+  bool optimal_ = true;
+  double gap_ = 0;
+  MIPSolver::Termination termination_ = MIPSolver::finished;
+  size_t nodes_ = 0;
+  std::vector<MIPSolver::Statistics> statistics_;
+  std::vector<Convergence> convergence_;
+
+  std::string dumpDirectory_;
+  std::unique_ptr<Model> model_;
+
   size_t iteration_;
   StatusCallback callback_;
 };
+
+struct Optimizer::BatchResult
+{
+  Optimizer optimizer;
+  bool ok = false;
+  double seconds = 0;
+};
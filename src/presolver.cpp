@@ -0,0 +1,498 @@
+// MIT License
+//
+// Copyright (c) 2019 Ivan Kelarev
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "presolver.h"
+#include "mipengine.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <map>
+
+namespace
+{
+  const double FeasibilityTolerance = 1e-6;
+  const double IntegralityTolerance = 1e-6;
+}
+
+MIPSolver::Presolver::Presolver(const MIPSolver &s) : source_(s), vars_(s.vars_), reduced_(StatusCallback(s.callback_))
+{
+  for (size_t i = 0; i < vars_.size(); i++)
+  {
+    lb_.push_back(vars_[i].min);
+    ub_.push_back(vars_[i].max);
+  }
+
+  keep_.assign(vars_.size(), false);
+  for (auto it = s.squares_.begin(); it != s.squares_.end(); it++)
+  {
+    keep_[it->var] = true;
+  }
+
+  for (auto it = s.conds_.begin(); it != s.conds_.end(); it++)
+  {
+    const Expression &expr = it->GetExpression();
+
+    Row row;
+    for (auto f = expr.GetFactors().begin(); f != expr.GetFactors().end(); f++)
+    {
+      if (f->second != 0) row.f.push_back(*f);
+    }
+    row.lo = it->GetRelation() == lessOrEqual    ? -INFINITY : -expr.GetC();
+    row.hi = it->GetRelation() == greaterOrEqual ?  INFINITY : -expr.GetC();
+    rows_.push_back(std::move(row));
+  }
+
+  // A few rounds are enough, each one only shrinks the model
+  for (int round = 0; round < 5 && !infeasible_; round++)
+  {
+    bool changed = false;
+    for (int pass = 0; pass < 10 && !infeasible_; pass++)
+    {
+      bool tightened = false;
+      for (size_t i = 0; i < rows_.size() && !infeasible_; i++)
+      {
+        tightened = Propagate(rows_[i]) || tightened;
+      }
+      if (!tightened) break;
+      changed = true;
+    }
+
+    if (infeasible_) break;
+
+    changed = Simplify() || changed;
+    if (!changed) break;
+  }
+
+  if (!infeasible_)
+  {
+    RemoveDuplicates();
+  }
+  if (!infeasible_)
+  {
+    Build(s);
+  }
+}
+
+MIPSolver::Expression MIPSolver::Presolver::Reduce(const Expression &expr) const
+{
+  return std::move(Reduce(expr.GetFactors(), expr.GetC()));
+}
+
+MIPSolver::Vector MIPSolver::Presolver::Reduce(const Vector &x) const
+{
+  if (x.empty()) return Vector();
+
+  Vector res(reduced_.vars_.size(), 0);
+  for (size_t i = 0; i < x.size(); i++)
+  {
+    double eps = FeasibilityTolerance * (1 + fabs(x[i]));
+    if (x[i] < lb_[i] - eps || x[i] > ub_[i] + eps) return Vector();
+
+    if (map_[i]) res[map_[i]] = std::min(std::max(x[i], lb_[i]), ub_[i]);
+  }
+  return std::move(res);
+}
+
+MIPSolver::Vector MIPSolver::Presolver::Restore(const Vector &x) const
+{
+  if (x.empty()) return Vector();
+
+  Vector res(vars_.size());
+  for (size_t i = 0; i < vars_.size(); i++)
+  {
+    res[i] = map_[i] ? x[map_[i]] : lb_[i];
+  }
+  return std::move(res);
+}
+
+bool MIPSolver::Presolver::Propose(const Vector &relaxation, Vector &x) const
+{
+  Vector y;
+  if (!source_.Propose(Restore(relaxation), y)) return false;
+
+  x = Reduce(y);
+  return !x.empty();
+}
+
+bool MIPSolver::Presolver::Propagate(const Row &row)
+{
+  double minAct, maxAct;
+  GetActivity(row, minAct, maxAct);
+
+  if (minAct > row.hi + FeasibilityTolerance * (1 + fabs(row.hi)) ||
+    maxAct < row.lo - FeasibilityTolerance * (1 + fabs(row.lo)))
+  {
+    infeasible_ = true;
+    return false;
+  }
+
+  // Each variable is bounded by the row and the extreme activity of the others
+  bool changed = false;
+  for (auto f = row.f.begin(); f != row.f.end(); f++)
+  {
+    size_t j = f->first;
+    double a = f->second;
+
+    // An infinite bound of the variable itself leaves the rest of the activity unknown
+    double minOwn = a > 0 ? a * lb_[j] : a * ub_[j];
+    double maxOwn = a > 0 ? a * ub_[j] : a * lb_[j];
+    double minRest = std::isinf(minOwn) ? -INFINITY : minAct - minOwn;
+    double maxRest = std::isinf(maxOwn) ?  INFINITY : maxAct - maxOwn;
+
+    double lo = -INFINITY, hi = INFINITY;
+    if (!std::isinf(row.hi) && !std::isinf(minRest))
+    {
+      (a > 0 ? hi : lo) = (row.hi - minRest) / a;
+    }
+    if (!std::isinf(row.lo) && !std::isinf(maxRest))
+    {
+      (a > 0 ? lo : hi) = (row.lo - maxRest) / a;
+    }
+
+    if (SetBounds(j, lo, hi, row.f.size() == 1))
+    {
+      changed = true;
+      GetActivity(row, minAct, maxAct);
+    }
+    if (infeasible_) break;
+  }
+
+  return changed;
+}
+
+bool MIPSolver::Presolver::SetBounds(size_t var, double lo, double hi, bool exact)
+{
+  if (vars_[var].type != continuous)
+  {
+    lo = ceil(lo - IntegralityTolerance);
+    hi = floor(hi + IntegralityTolerance);
+  }
+  else if (!exact)
+  {
+    // Derived bounds of continuous variables are relaxed a little against rounding errors
+    lo -= FeasibilityTolerance * 0.1 * (1 + fabs(lo));
+    hi += FeasibilityTolerance * 0.1 * (1 + fabs(hi));
+  }
+
+  // Insignificant changes are ignored, otherwise propagation of continuous bounds may never end
+  double eps = FeasibilityTolerance * (1 + std::max(fabs(lb_[var]), fabs(ub_[var])));
+
+  bool changed = false;
+  if (lo > lb_[var] + eps || (exact && lo > lb_[var]))
+  {
+    lb_[var] = lo;
+    changed = true;
+  }
+  if (hi < ub_[var] - eps || (exact && hi < ub_[var]))
+  {
+    ub_[var] = hi;
+    changed = true;
+  }
+
+  if (lb_[var] > ub_[var])
+  {
+    if (lb_[var] > ub_[var] + eps)
+    {
+      infeasible_ = true;
+    }
+    else
+    {
+      lb_[var] = ub_[var] = vars_[var].type != continuous ? floor(ub_[var] + 0.5) : (lb_[var] + ub_[var]) / 2;
+    }
+  }
+
+  return changed;
+}
+
+void MIPSolver::Presolver::GetActivity(const Row &row, double &minAct, double &maxAct) const
+{
+  minAct = 0;
+  maxAct = 0;
+  for (auto f = row.f.begin(); f != row.f.end(); f++)
+  {
+    double a = f->second;
+    minAct += a > 0 ? a * lb_[f->first] : a * ub_[f->first];
+    maxAct += a > 0 ? a * ub_[f->first] : a * lb_[f->first];
+  }
+}
+
+bool MIPSolver::Presolver::IsBinary(size_t var) const
+{
+  return vars_[var].type != continuous && lb_[var] == 0 && ub_[var] == 1;
+}
+
+bool MIPSolver::Presolver::Simplify()
+{
+  bool changed = false;
+
+  std::vector<Row> rows;
+  for (auto it = rows_.begin(); it != rows_.end(); it++)
+  {
+    Row &row = *it;
+
+    // Fixed variables become constants
+    Expression::Factors f;
+    double c = 0;
+    for (auto it = row.f.begin(); it != row.f.end(); it++)
+    {
+      if (lb_[it->first] == ub_[it->first] && !keep_[it->first])
+      {
+        c += it->second * lb_[it->first];
+      }
+      else
+      {
+        f.push_back(*it);
+      }
+    }
+    if (f.size() != row.f.size())
+    {
+      row.f.swap(f);
+      row.lo -= c;
+      row.hi -= c;
+      changed = true;
+    }
+
+    // Singleton rows are just bounds
+    if (row.f.size() == 1 && !keep_[row.f.front().first])
+    {
+      Propagate(row);
+      if (infeasible_) return false;
+      changed = true;
+      continue;
+    }
+
+    double minAct, maxAct;
+    GetActivity(row, minAct, maxAct);
+
+    bool hiRedundant = maxAct <= row.hi + FeasibilityTolerance * 1e-3 * (1 + fabs(row.hi));
+    bool loRedundant = minAct >= row.lo - FeasibilityTolerance * 1e-3 * (1 + fabs(row.lo));
+    if (hiRedundant && loRedundant)
+    {
+      changed = true;
+      continue;
+    }
+    if (hiRedundant && !std::isinf(row.hi))
+    {
+      row.hi = INFINITY;
+      changed = true;
+    }
+    if (loRedundant && !std::isinf(row.lo))
+    {
+      row.lo = -INFINITY;
+      changed = true;
+    }
+
+    changed = Tighten(row) || changed;
+    rows.push_back(std::move(row));
+  }
+
+  rows_.swap(rows);
+  return changed;
+}
+
+bool MIPSolver::Presolver::Tighten(Row &row)
+{
+  // Only one-sided rows, in the form of a * x <= b
+  if (!std::isinf(row.lo) && !std::isinf(row.hi)) return false;
+
+  double sign = std::isinf(row.lo) ? 1 : -1;
+  double b = sign * (std::isinf(row.lo) ? row.hi : row.lo);
+
+  bool changed = false;
+  for (auto f = row.f.begin(); f != row.f.end(); f++)
+  {
+    if (!IsBinary(f->first)) continue;
+
+    double maxAct = 0;
+    for (auto g = row.f.begin(); g != row.f.end(); g++)
+    {
+      double a = sign * g->second;
+      maxAct += a > 0 ? a * ub_[g->first] : a * lb_[g->first];
+    }
+
+    double a = sign * f->second;
+    double eps = FeasibilityTolerance * (1 + fabs(b));
+
+    // The row is redundant for one value of the binary, so its coefficient may be closer to the rest
+    if (a > 0 && maxAct - a < b - eps)
+    {
+      double d = b - (maxAct - a);
+      a -= d;
+      b -= d;
+    }
+    else if (a < 0 && maxAct + a < b - eps)
+    {
+      a += b - (maxAct + a);
+    }
+    else
+    {
+      continue;
+    }
+
+    f->second = sign * a;
+    changed = true;
+  }
+
+  if (changed)
+  {
+    row.f.erase(std::remove_if(row.f.begin(), row.f.end(), [](const Expression::Factor &f) { return f.second == 0; }),
+      row.f.end());
+    (std::isinf(row.lo) ? row.hi : row.lo) = sign * b;
+  }
+
+  return changed;
+}
+
+void MIPSolver::Presolver::RemoveDuplicates()
+{
+  // Rows of proportional coefficients are merged into one, scaled so that the first coefficient is one
+  std::map<Expression::Factors, size_t> index;
+  std::vector<Row> rows;
+  for (auto it = rows_.begin(); it != rows_.end(); it++)
+  {
+    if (it->f.empty())
+    {
+      infeasible_ = infeasible_ || it->lo > FeasibilityTolerance * (1 + fabs(it->lo)) ||
+        it->hi < -FeasibilityTolerance * (1 + fabs(it->hi));
+      continue;
+    }
+
+    Row row = *it;
+    double k = row.f.front().second;
+    for (auto f = row.f.begin(); f != row.f.end(); f++)
+    {
+      f->second /= k;
+    }
+    row.lo /= k;
+    row.hi /= k;
+    if (k < 0) std::swap(row.lo, row.hi);
+
+    auto found = index.find(row.f);
+    if (found == index.end())
+    {
+      index[row.f] = rows.size();
+      rows.push_back(std::move(row));
+    }
+    else
+    {
+      Row &dup = rows[found->second];
+      dup.lo = std::max(dup.lo, row.lo);
+      dup.hi = std::min(dup.hi, row.hi);
+      if (dup.lo > dup.hi)
+      {
+        infeasible_ = infeasible_ || dup.lo > dup.hi + FeasibilityTolerance * (1 + fabs(dup.hi));
+        dup.lo = dup.hi = (dup.lo + dup.hi) / 2;
+      }
+    }
+  }
+
+  rows_.swap(rows);
+}
+
+void MIPSolver::Presolver::Build(const MIPSolver &s)
+{
+  reduced_.threads_ = s.threads_;
+  reduced_.options_ = s.options_;
+  reduced_.deadline_ = s.deadline_;
+  if (s.heuristic_)
+  {
+    reduced_.presolver_ = this;
+  }
+
+  map_.assign(vars_.size(), 0);
+  columns_.resize(reduced_.vars_.size());
+  for (size_t i = 0; i < vars_.size(); i++)
+  {
+    if (lb_[i] != ub_[i] || keep_[i])
+    {
+      map_[i] = columns_.size();
+      columns_.push_back(reduced_.CreateVariable(vars_[i].type, lb_[i], ub_[i]));
+      reduced_.vars_.back().priority = vars_[i].priority;
+    }
+  }
+
+  // Rows may still have variables fixed by the last propagation
+  for (auto it = rows_.begin(); it != rows_.end(); it++)
+  {
+    Expression expr = Reduce(it->f, 0);
+    if (expr.GetFactors().empty())
+    {
+      double v = expr.GetC();
+      infeasible_ = infeasible_ || v < it->lo - FeasibilityTolerance * (1 + fabs(it->lo)) ||
+        v > it->hi + FeasibilityTolerance * (1 + fabs(it->hi));
+      continue;
+    }
+
+    if (it->lo == it->hi)
+    {
+      reduced_.AddCondition(expr == it->lo);
+      continue;
+    }
+    if (!std::isinf(it->lo))
+    {
+      reduced_.AddCondition(expr >= it->lo);
+    }
+    if (!std::isinf(it->hi))
+    {
+      reduced_.AddCondition(expr <= it->hi);
+    }
+  }
+
+  for (auto it = s.squares_.begin(); it != s.squares_.end(); it++)
+  {
+    Expression expr = Reduce(it->factors, it->c);
+    reduced_.squares_.push_back({ map_[it->var], expr.GetFactors(), expr.GetC() });
+  }
+
+  // Lazy conditions take no part in the reduction, they only lose the fixed variables
+  for (auto it = s.lazy_.begin(); it != s.lazy_.end(); it++)
+  {
+    Expression expr = Reduce(it->GetExpression());
+    Relation rel = it->GetRelation();
+    Condition cond = rel == lessOrEqual ? expr <= 0 : rel == greaterOrEqual ? expr >= 0 : expr == 0;
+
+    if (expr.GetFactors().empty())
+    {
+      infeasible_ = infeasible_ || !IsSatisfied(cond, Vector());
+      continue;
+    }
+    reduced_.lazy_.push_back(cond);
+  }
+}
+
+MIPSolver::Expression MIPSolver::Presolver::Reduce(const Expression::Factors &f, double c) const
+{
+  Expression res = c;
+  for (auto it = f.begin(); it != f.end(); it++)
+  {
+    if (map_[it->first])
+    {
+      res += it->second * columns_[map_[it->first]];
+    }
+    else
+    {
+      res += it->second * lb_[it->first];
+    }
+  }
+  return std::move(res);
+}
@@ -0,0 +1,81 @@
+// MIT License
+//
+// Copyright (c) 2019 Ivan Kelarev
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "mipsolver.h"
+
+#include <vector>
+
+// Builds a smaller model of the same integer solutions: propagates bounds, substitutes fixed variables,
+// removes singleton, redundant and duplicate rows and tightens big-M coefficients of binaries.
+// Variables are only ever removed when they are fixed, so a solution is mapped back by their values.
+class MIPSolver::Presolver
+{
+public:
+  explicit Presolver(const MIPSolver &s);
+
+  bool IsInfeasible() const { return infeasible_; }
+
+  // The reduced model shares the settings and the status callback of the source one
+  const MIPSolver &GetModel() const { return reduced_; }
+
+  Expression Reduce(const Expression &expr) const;
+  Vector Reduce(const Vector &x) const; // Empty if the point is out of the reduced bounds
+  Vector Restore(const Vector &x) const;
+
+  // The heuristic of the source model proposes solutions of the reduced one
+  bool Propose(const Vector &relaxation, Vector &x) const;
+
+private:
+  struct Row
+  {
+    Expression::Factors f;
+    double lo;
+    double hi;
+  };
+
+  bool Propagate(const Row &row);
+  bool SetBounds(size_t var, double lo, double hi, bool exact);
+  void GetActivity(const Row &row, double &minAct, double &maxAct) const;
+  bool IsBinary(size_t var) const;
+
+  bool Simplify();
+  bool Tighten(Row &row);
+  void RemoveDuplicates();
+  void Build(const MIPSolver &s);
+  Expression Reduce(const Expression::Factors &f, double c) const;
+
+private:
+  const MIPSolver &source_;
+  const std::vector<VariableInfo> &vars_;
+  std::vector<double> lb_;
+  std::vector<double> ub_;
+  std::vector<bool> keep_; // Variables of squares stay even if fixed, their conditions are not known here
+
+  std::vector<Row> rows_;
+  bool infeasible_ = false;
+
+  std::vector<size_t> map_; // Index in the reduced model, zero if removed (the reduced one has its own dummy)
+  MIPSolver reduced_;
+  std::vector<Variable> columns_; // By index in the reduced model
+};
@@ -0,0 +1,175 @@
+// MIT License
+//
+// Copyright (c) 2019 Ivan Kelarev
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "allocation.h"
+#include "mipengine.h"
+#include "tableformatter.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Replays models dumped by the allocator (--dump-models) with the solver settings of a config
+int main(int argc, char* argv[])
+{
+  std::string config;
+  std::vector<std::string> models;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg(argv[i]);
+
+    if (arg == "-h" || arg == "--help")
+    {
+      std::cout << "Usage:" << std::endl;
+      std::cout << "  " << argv[0] << " [--config <config>] <model.mps>..." << std::endl;
+      return 0;
+    }
+
+    if (arg == "--config")
+    {
+      if (++i == argc)
+      {
+        std::cout << "Error: Config file was not specified" << std::endl;
+        return 1;
+      }
+      config = argv[i];
+    }
+    else
+    {
+      models.push_back(arg);
+    }
+  }
+
+  if (models.empty())
+  {
+    std::cout << "Error: No models were specified" << std::endl;
+    return 1;
+  }
+
+  // Only the solver settings of the config matter
+  Allocation a;
+  if (!config.empty() && !a.Load(config))
+  {
+    std::cout << "Error: Failed to load config '" << config << "'" << std::endl;
+    return 1;
+  }
+
+  if (!MIPSolver::CreateEngine(a.GetSolverName()))
+  {
+    std::cout << "Error: Unknown solver: " << a.GetSolverName() << std::endl;
+    return 1;
+  }
+  std::cout << "Solver: " << a.GetSolverName() << std::endl;
+
+  TableFormatter tf;
+  tf[0][0] = "Model";
+  tf[0][1] = "Time";
+  tf[0][2] = "Nodes";
+  tf[0][3] = "Objective";
+  tf[0][4] = "Gap";
+
+  double totalTime = 0;
+  double totalNodes = 0;
+  bool failed = false;
+
+  for (size_t i = 0; i < models.size(); i++)
+  {
+    auto row = tf[i + 1];
+    row[0] = models[i];
+
+    MIPSolver s;
+    s.SetEngine(a.GetSolverName());
+    s.SetThreads(a.GetThreads());
+    s.SetOptions(a.GetSolverOptions());
+
+    MIPSolver::Expression objective;
+    if (!s.LoadModel(models[i], objective))
+    {
+      row[1] = "Failed to load";
+      row[1].Merge(0, 3);
+      failed = true;
+      continue;
+    }
+
+    auto start = MIPSolver::Clock::now();
+    if (a.GetTimeLimit() > 0)
+    {
+      auto limit = std::chrono::duration<double>(a.GetTimeLimit());
+      s.SetDeadline(start + std::chrono::duration_cast<MIPSolver::Clock::duration>(limit));
+    }
+
+    auto sol = s.Minimize(objective);
+    double time = std::chrono::duration<double>(MIPSolver::Clock::now() - start).count();
+
+    row[1] = time;
+    row[2] = static_cast<double>(sol.GetNodeCount());
+    if (sol)
+    {
+      row[3] = sol(objective);
+      row[4] = sol.GetGap() * 100;
+    }
+    else
+    {
+      row[3] = "No solution";
+      row[3].Merge(0, 1);
+    }
+
+    totalTime += time;
+    totalNodes += sol.GetNodeCount();
+  }
+
+  auto total = tf[models.size() + 1];
+  total[0] = "Total";
+  total[1] = totalTime;
+  total[2] = totalNodes;
+
+  tf.GetRow(0)
+    .AddFrame(TableFormatter::topbottom)
+    .SetAlign(TableFormatter::acenter);
+  tf.GetRow(models.size() + 1)
+    .AddFrame(TableFormatter::topbottom);
+
+  (tf.GetCol(1) ^ tf.GetRow(0))
+    .SetDigits(3)
+    .SetSuffix("s")
+    .SetAlign(TableFormatter::aright);
+
+  (tf.GetCol(2) ^ tf.GetRow(0))
+    .SetDigits(0)
+    .SetAlign(TableFormatter::aright);
+
+  (tf.GetCol(3) ^ tf.GetRow(0))
+    .SetDigits(6)
+    .SetAlign(TableFormatter::aright);
+
+  (tf.GetCol(4) ^ tf.GetRow(0))
+    .SetDigits(2)
+    .SetSuffix("%")
+    .SetAlign(TableFormatter::aright);
+
+  tf.Render(std::cout);
+
+  return failed ? 1 : 0;
+}
@@ -34,6 +34,7 @@ TEST_CASE("EmptyAllocationTest", "[allocation]")
   REQUIRE(!a.HasTargetCash());
   REQUIRE(a.UseAllCash() == false);
   REQUIRE(a.GetMaxDeals() == 0);
+  REQUIRE(a.GetAlternatives() == 0);
 
   std::string s = "[have]\n\n\nspy=0\n\n";
   std::stringstream ss(s);
@@ -85,6 +86,7 @@ TEST_CASE("FullAllocationTest", "[allocation]")
     "commission = 2\n"
     "no more deals = true\n"
     "max deals = 5\n"
+    "alternatives = 2\n"
     "\n"
     "[have]\n"
     "vti = 3\n";
@@ -137,6 +139,7 @@ TEST_CASE("FullAllocationTest", "[allocation]")
   REQUIRE(a.IsTargetCashInPercents());
   REQUIRE(a.UseAllCash() == true);
   REQUIRE(a.GetMaxDeals() == 5);
+  REQUIRE(a.GetAlternatives() == 2);
 }
 
 TEST_CASE("ModelTest", "[allocation]")
@@ -157,6 +160,15 @@ TEST_CASE("ModelTest", "[allocation]")
   REQUIRE(b);
 
   REQUIRE(a.UseLeastSquaresApproximation() == true);
+  REQUIRE(a.UseExactLeastSquares() == false);
+
+  ss.clear();
+  ss.str("[options]\nmodel=ls");
+  b = a.Load(ss);
+  REQUIRE(b);
+
+  REQUIRE(a.UseLeastSquaresApproximation() == true);
+  REQUIRE(a.UseExactLeastSquares() == true);
 
   ss.clear();
   ss.str("[options]\nmodel=lad");
@@ -164,4 +176,133 @@ TEST_CASE("ModelTest", "[allocation]")
   REQUIRE(b);
 
   REQUIRE(a.UseLeastSquaresApproximation() == false);
+  REQUIRE(a.UseExactLeastSquares() == false);
+}
+
+TEST_CASE("SolverTest", "[allocation]")
+{
+  Allocation a;
+  REQUIRE(a.GetSolverName() == "GLPK");
+
+  std::stringstream ss("[options]\nsolver=glpk");
+
+  bool b = a.Load(ss);
+  REQUIRE(b);
+
+  REQUIRE(a.GetSolverName() == "GLPK");
+}
+
+TEST_CASE("ThreadsTest", "[allocation]")
+{
+  Allocation a;
+  REQUIRE(a.GetThreads() == 1);
+
+  std::stringstream ss("[options]\nsolver=bnb\nthreads=4");
+
+  bool b = a.Load(ss);
+  REQUIRE(b);
+
+  REQUIRE(a.GetSolverName() == "BNB");
+  REQUIRE(a.GetThreads() == 4);
+}
+
+TEST_CASE("TimeLimitTest", "[allocation]")
+{
+  Allocation a;
+  REQUIRE(a.GetTimeLimit() == 0);
+
+  std::stringstream ss("[options]\ntime limit=2.5");
+
+  bool b = a.Load(ss);
+  REQUIRE(b);
+
+  REQUIRE(a.GetTimeLimit() == 2.5);
+
+  Allocation bad;
+  std::stringstream ssBad("[options]\ntime limit=-1");
+  REQUIRE_FALSE(bad.Load(ssBad));
+}
+
+TEST_CASE("SolverOptionsTest", "[allocation]")
+{
+  Allocation a;
+  REQUIRE(a.GetSolverOptions().branching == MIPSolver::Options::driebeckTomlin);
+  REQUIRE(a.GetSolverOptions().backtracking == MIPSolver::Options::bestLocalBound);
+  REQUIRE_FALSE(a.GetSolverOptions().mirCuts);
+  REQUIRE(a.GetSolverOptions().presolve);
+  REQUIRE_FALSE(a.GetSolverOptions().reduceModel);
+  REQUIRE_FALSE(a.GetSolverOptions().priorities);
+  REQUIRE(a.GetRefPointTolerance() == 0.5);
+  REQUIRE(a.GetRelativeRefPointTolerance() == 0);
+  REQUIRE(a.GetMaxIterations() == 0);
+  REQUIRE_FALSE(a.UseMultiscaleRefPoints());
+  REQUIRE_FALSE(a.UseRoundingHeuristic());
+
+  std::stringstream ss(
+    "[solver]\n"
+    "branching = pch\n"
+    "backtracking = dfs\n"
+    "preprocessing = all\n"
+    "mir cuts = yes\n"
+    "clique cuts = yes\n"
+    "mip gap = 0.1%\n"
+    "time limit = 5\n"
+    "presolve = no\n"
+    "reduce model = yes\n"
+    "branching priorities = yes\n"
+    "refpoint tolerance = 10\n"
+    "relative refpoint tolerance = 0.5%\n"
+    "max iterations = 3\n"
+    "multiscale refpoints = yes\n"
+    "rounding heuristic = yes\n"
+    "scaling = gm, eq, 2n\n");
+
+  bool b = a.Load(ss);
+  REQUIRE(b);
+
+  const MIPSolver::Options &o = a.GetSolverOptions();
+  REQUIRE(o.branching == MIPSolver::Options::pseudoCost);
+  REQUIRE(o.backtracking == MIPSolver::Options::depthFirst);
+  REQUIRE(o.preprocessing == MIPSolver::Options::allPreprocessing);
+  REQUIRE(o.mirCuts);
+  REQUIRE(o.cliqueCuts);
+  REQUIRE_FALSE(o.gomoryCuts);
+  REQUIRE_FALSE(o.coverCuts);
+  REQUIRE(o.mipGap == Approx(0.001));
+  REQUIRE(o.timeLimit == 5);
+  REQUIRE_FALSE(o.presolve);
+  REQUIRE(o.reduceModel);
+  REQUIRE(o.priorities);
+  REQUIRE(a.GetRefPointTolerance() == 10);
+  REQUIRE(a.GetRelativeRefPointTolerance() == Approx(0.005));
+  REQUIRE(a.GetMaxIterations() == 3);
+  REQUIRE(a.UseMultiscaleRefPoints());
+  REQUIRE(a.UseRoundingHeuristic());
+  REQUIRE(o.scaleGeometric);
+  REQUIRE(o.scaleEquilibrate);
+  REQUIRE(o.scaleRoundToPowerOf2);
+  REQUIRE_FALSE(o.scaleAuto);
+  REQUIRE(a.GetEncoding() == MIPSolver::segmentEncoding);
+
+  Allocation bad;
+  std::stringstream ssBad("[solver]\nbranching = random");
+  REQUIRE_FALSE(bad.Load(ssBad));
+}
+
+TEST_CASE("EncodingTest", "[allocation]")
+{
+  Allocation a;
+  REQUIRE(a.GetEncoding() == MIPSolver::segmentEncoding);
+
+  std::stringstream ss("[solver]\nencoding = logarithmic");
+
+  bool b = a.Load(ss);
+  REQUIRE(b);
+
+  REQUIRE(a.GetEncoding() == MIPSolver::logarithmicEncoding);
+
+  Allocation c;
+  std::stringstream ssConvex("[solver]\nencoding = convex");
+  REQUIRE(c.Load(ssConvex));
+  REQUIRE(c.GetEncoding() == MIPSolver::convexEncoding);
 }
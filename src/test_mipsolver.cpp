@@ -23,7 +23,11 @@
 #include "mipsolver.h"
 
 #include <catch.hpp>
+#include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <map>
 
 TEST_CASE("TestNoSolution", "[mipsolver]")
 {
@@ -654,6 +658,170 @@ TEST_CASE("SquareApproximationTest", "[mipsolver]")
   }
 }
 
+TEST_CASE("RefineSquareApproximationTest", "[mipsolver]")
+{
+  MIPSolver::Encoding encodings[] = { MIPSolver::segmentEncoding, MIPSolver::logarithmicEncoding, MIPSolver::convexEncoding };
+  for (size_t e = 0; e < sizeof(encodings) / sizeof(*encodings); e++)
+  {
+    MIPSolver s;
+    auto x = s.GetIntegerVariable(-20, 20);
+    auto expr = 2 * x - 6.6; // No value rounds to the first refpoint
+
+    MIPSolver::RefPoints refpoints;
+    auto q = s.GetSquareApproximation(expr, refpoints, encodings[e]);
+
+    MIPSolver::Solution sol;
+    for (int iteration = 0; iteration < 20; iteration++)
+    {
+      size_t variables = sol ? sol.GetStatistics().variables : 0;
+      sol = s.Minimize(q, sol);
+      REQUIRE(sol);
+
+      // Each refinement adds a single variable, the rest of the model is kept
+      if (variables)
+      {
+        REQUIRE(sol.GetStatistics().variables == variables + 1);
+      }
+
+      // The approximation is exact at the refpoints and below the square elsewhere
+      REQUIRE(sol(q) <= sol(expr) * sol(expr) + 1e-6);
+
+      if (!refpoints.insert(sol(expr))) break;
+      q = s.RefineSquareApproximation(q, expr, refpoints);
+    }
+
+    REQUIRE(sol(x) == 3);
+    REQUIRE(sol(q) == Approx(0.36));
+
+    // Nothing new, nothing to refine
+    REQUIRE(s.RefineSquareApproximation(q, expr, refpoints).GetFactors() == q.GetFactors());
+  }
+}
+
+TEST_CASE("LogarithmicEncodingTest", "[mipsolver]")
+{
+  for (int n = 1; n <= 9; n++)
+  {
+    MIPSolver::RefPoints refpoints;
+    for (int i = 0; i < n; i++)
+    {
+      refpoints.insert(-20 + rand() % 41);
+    }
+
+    MIPSolver s;
+    auto x = s.GetIntegerVariable(-20, 20);
+    MIPSolver::RefPoints segmentPoints = refpoints;
+    auto q1 = s.GetSquareApproximation(x, segmentPoints, MIPSolver::segmentEncoding);
+    auto q2 = s.GetSquareApproximation(x, refpoints, MIPSolver::logarithmicEncoding);
+
+    for (int v = -20; v <= 20; v += 3)
+    {
+      MIPSolver t = s;
+      t.Restrict(x == v);
+
+      // Only two neighbouring breakpoints are allowed, so the value is the same in both directions
+      auto min = t.Minimize(q2);
+      REQUIRE(min);
+      auto max = t.Maximize(q2);
+      REQUIRE(max);
+
+      REQUIRE(fabs(min(q2) - max(q2)) < 1e-6);
+      REQUIRE(fabs(min(q1) - min(q2)) < 1e-6);
+      REQUIRE(min(q2) <= v * v + 1e-6);
+    }
+
+    // The previous solution is completed for the new variables of a refined approximation
+    auto sol = s.Minimize(q2 - 10 * x);
+    REQUIRE(sol);
+
+    refpoints.insert(sol(x) > 0 ? sol(x) - 1 : sol(x) + 1);
+    auto q3 = s.GetSquareApproximation(x, refpoints, MIPSolver::logarithmicEncoding);
+    auto next = s.Minimize(q3 - 10 * x, sol);
+    REQUIRE(next);
+    REQUIRE(next(q3 - 10 * x) <= sol(q3 - 10 * x) + 1e-6);
+  }
+}
+
+TEST_CASE("ConvexEncodingTest", "[mipsolver]")
+{
+  SECTION("Absolute value")
+  {
+    MIPSolver s;
+    auto x = s.GetIntegerVariable(-10, 10);
+    auto y = s.GetIntegerVariable(-10, 10);
+    s.Restrict(x + y == 7);
+
+    auto a = s.GetAbsoluteValue(x - 2 * y, MIPSolver::convexEncoding);
+    auto b = s.GetAbsoluteValue(x - 2 * y);
+
+    auto sol = s.Minimize(a);
+    REQUIRE(sol);
+    REQUIRE(sol(a) == 1);
+    REQUIRE(sol(a) == sol(b));
+  }
+
+  SECTION("Square approximation")
+  {
+    for (int n = 1; n <= 5; n++)
+    {
+      MIPSolver::RefPoints refpoints;
+      for (int i = 0; i < n; i++)
+      {
+        refpoints.insert(-20 + rand() % 41);
+      }
+
+      MIPSolver s;
+      auto x = s.GetIntegerVariable(-20, 20);
+      MIPSolver::RefPoints segmentPoints = refpoints;
+      auto q1 = s.GetSquareApproximation(x, segmentPoints);
+      auto q2 = s.GetSquareApproximation(x, refpoints, MIPSolver::convexEncoding);
+
+      for (int v = -20; v <= 20; v += 3)
+      {
+        MIPSolver t = s;
+        t.Restrict(x == v);
+
+        auto sol = t.Minimize(q2);
+        REQUIRE(sol);
+        REQUIRE(fabs(sol(q1) - sol(q2)) < 1e-6);
+      }
+
+      auto sol = s.Minimize(q2 - 7 * x);
+      REQUIRE(sol);
+      REQUIRE(fabs(sol(q1) - sol(q2)) < 1e-6);
+    }
+  }
+}
+
+TEST_CASE("SquareTest", "[mipsolver]")
+{
+  const char *engines[] = { "GLPK", "BNB" };
+  for (auto engine : engines)
+  {
+    MIPSolver s;
+    REQUIRE(s.SetEngine(engine));
+
+    auto x = s.GetIntegerVariable(-10, 10);
+    auto y = s.GetIntegerVariable(-10, 10);
+    s.Restrict(x + y <= 3);
+
+    auto q = s.GetSquare(x - 3.3) + s.GetSquare(y - 2.6);
+    auto sol = s.Minimize(q);
+    REQUIRE(sol);
+
+    // (3.3 - x)^2 + (2.6 - y)^2 on x + y <= 3: the best integer point is (2, 1)
+    REQUIRE(sol(x + y) == 3);
+    REQUIRE(sol(x) == 2);
+    REQUIRE(fabs(sol(q) - (1.3 * 1.3 + 1.6 * 1.6)) < 1e-4);
+
+    // The start is completed with exact squares
+    auto z = s.GetIntegerVariable(-10, 10);
+    auto next = s.Minimize(q + s.GetSquare(z - x), sol);
+    REQUIRE(next);
+    REQUIRE(next(z) == 2);
+  }
+}
+
 TEST_CASE("CheckpointTest", "[mipsolver]")
 {
   MIPSolver s;
@@ -683,3 +851,885 @@ TEST_CASE("CheckpointTest", "[mipsolver]")
   sol = s.Maximize(x);
   REQUIRE(sol(x) == 100);
 }
+
+TEST_CASE("IncrementalModelTest", "[mipsolver]")
+{
+  MIPSolver s;
+
+  auto x = s.GetIntegerVariable(100);
+  auto y = s.GetIntegerVariable(100);
+  s.Restrict(x + y <= 50);
+
+  auto sol = s.Maximize(x + 2 * y);
+  REQUIRE(sol(y) == 50);
+
+  MIPSolver::Checkpoint cp = s.CreateCheckpoint();
+
+  auto z = s.GetIntegerVariable(100);
+  s.Restrict(y + z <= 10);
+  s.Restrict(x - z >= 5);
+
+  // The only optimum: both sums at their limits and y at its maximum
+  sol = s.Maximize(x + 3 * y + z);
+  REQUIRE(sol(x + 3 * y + z) == 70);
+  REQUIRE(sol(x) == 40);
+  REQUIRE(sol(y) == 10);
+  REQUIRE(sol(z) == 0);
+
+  s.Rollback(cp);
+  sol = s.Maximize(x);
+  REQUIRE(sol(x) == 50);
+
+  auto t = s.GetBinaryVariable();
+  s.Restrict(x <= 20 + 10 * t);
+
+  MIPSolver c = s;
+
+  sol = s.Maximize(x - t);
+  REQUIRE(sol(x) == 30);
+  REQUIRE(sol(t) == 1);
+
+  sol = s.Minimize(x + y - 10 * t);
+  REQUIRE(sol(t) == 1);
+
+  c.Restrict(t == 0);
+  sol = c.Maximize(x);
+  REQUIRE(sol(x) == 20);
+
+  s.Rollback(cp);
+  sol = s.Maximize(x + 2 * y);
+  REQUIRE(sol(y) == 50);
+}
+
+TEST_CASE("WarmStartTest", "[mipsolver]")
+{
+  // approximate
+  //   (x - 1)^2 + (y - 2)^2 --> min
+  //   x + y >= 7
+
+  MIPSolver s;
+
+  auto x = s.GetIntegerVariable(-50, 50);
+  auto y = s.GetIntegerVariable(-50, 50);
+  s.Restrict(x + y >= 7);
+
+  MIPSolver::Checkpoint cp = s.CreateCheckpoint();
+
+  MIPSolver::RefPoints rx, ry;
+  MIPSolver::Solution sol;
+  for (;;)
+  {
+    auto sum = s.GetSquareApproximation(x - 1, rx) + s.GetSquareApproximation(y - 2, ry);
+
+    auto cold = MIPSolver(s).Minimize(sum);
+    REQUIRE(cold);
+
+    sol = s.Minimize(sum, sol);
+    REQUIRE(sol);
+    REQUIRE(fabs(sol(sum) - cold(sum)) < 1e-6);
+
+    bool done = true;
+    if (rx.insert(sol(x - 1))) done = false;
+    if (ry.insert(sol(y - 2))) done = false;
+    if (done) break;
+
+    s.Rollback(cp);
+  }
+
+  REQUIRE(pow(sol(x) - 1, 2) + pow(sol(y) - 2, 2) == 8);
+  REQUIRE(sol(x + y) == 7);
+
+  // An infeasible start is ignored
+  s.Restrict(x >= 30);
+  auto absy = s.GetAbsoluteValue(y - 2);
+
+  sol = s.Minimize(x + absy, sol);
+  REQUIRE(sol);
+  REQUIRE(sol(x) == 30);
+  REQUIRE(sol(y) == 2);
+}
+
+TEST_CASE("EngineTest", "[mipsolver]")
+{
+  MIPSolver s;
+
+  auto x = s.GetIntegerVariable(100);
+  s.Restrict(x <= 50);
+
+  auto sol = s.Maximize(x);
+  REQUIRE(sol(x) == 50);
+
+  REQUIRE_FALSE(s.SetEngine("UNKNOWN"));
+  REQUIRE(s.SetEngine("GLPK"));
+
+  s.Restrict(x <= 40);
+  sol = s.Maximize(x);
+  REQUIRE(sol(x) == 40);
+}
+
+template<class T>
+double SolveKnapsack(MIPSolver &s, const T &weights, const T &values, int capacity)
+{
+  MIPSolver::Expression weight, value;
+  for (size_t i = 0; i < weights.size(); i++)
+  {
+    auto x = s.GetIntegerVariable(3);
+    weight += weights[i] * x;
+    value += values[i] * x;
+  }
+  s.Restrict(weight <= capacity);
+
+  auto sol = s.Maximize(value);
+  REQUIRE(sol);
+  REQUIRE(sol(weight) <= capacity);
+  return sol(value);
+}
+
+TEST_CASE("BnbEngineTest", "[mipsolver]")
+{
+  SECTION("Infeasible")
+  {
+    MIPSolver s;
+    REQUIRE(s.SetEngine("BNB"));
+
+    auto x = s.GetIntegerVariable(10);
+    s.Restrict(2 * x == 5);
+
+    REQUIRE_FALSE(s.Minimize(x));
+  }
+
+  SECTION("Same as GLPK")
+  {
+    for (size_t threads = 1; threads <= 4; threads *= 2)
+    {
+      for (int i = 0; i < 20; i++)
+      {
+        std::vector<int> weights, values;
+        for (int j = 0; j < 15; j++)
+        {
+          weights.push_back(1 + rand() % 50);
+          values.push_back(1 + rand() % 50);
+        }
+        int capacity = 100 + rand() % 200;
+
+        MIPSolver glpk;
+
+        MIPSolver bnb;
+        REQUIRE(bnb.SetEngine("BNB"));
+        bnb.SetThreads(threads);
+
+        REQUIRE(SolveKnapsack(bnb, weights, values, capacity) == SolveKnapsack(glpk, weights, values, capacity));
+      }
+    }
+  }
+
+  SECTION("Warm start")
+  {
+    MIPSolver s;
+    REQUIRE(s.SetEngine("BNB"));
+    s.SetThreads(2);
+
+    auto x = s.GetIntegerVariable(100);
+    auto y = s.GetIntegerVariable(100);
+    s.Restrict(3 * x + 5 * y <= 97);
+
+    auto sol = s.Maximize(x + y);
+    REQUIRE(sol);
+    REQUIRE(sol(x + y) == 32);
+
+    sol = s.Maximize(x + 2 * y, sol);
+    REQUIRE(sol);
+    REQUIRE(sol(x + 2 * y) == 38);
+  }
+}
+
+TEST_CASE("OptionsTest", "[mipsolver]")
+{
+  std::vector<int> weights, values;
+  for (int i = 0; i < 20; i++)
+  {
+    weights.push_back(10 + i * 7 % 31);
+    values.push_back(5 + i * 11 % 37);
+  }
+
+  MIPSolver reference;
+  double optimum = SolveKnapsack(reference, weights, values, 250);
+
+  const char *engines[] = { "GLPK", "BNB" };
+  for (auto engine : engines)
+  {
+    MIPSolver::Options options;
+    options.branching = MIPSolver::Options::mostFractional;
+    options.backtracking = MIPSolver::Options::depthFirst;
+    options.preprocessing = MIPSolver::Options::allPreprocessing;
+    options.gomoryCuts = true;
+    options.mirCuts = true;
+    options.coverCuts = true;
+    options.cliqueCuts = true;
+    options.scaleGeometric = true;
+    options.scaleEquilibrate = true;
+
+    MIPSolver s;
+    REQUIRE(s.SetEngine(engine));
+    s.SetOptions(options);
+    REQUIRE(SolveKnapsack(s, weights, values, 250) == optimum);
+
+    options.mipGap = 0.5;
+
+    MIPSolver g;
+    REQUIRE(g.SetEngine(engine));
+    g.SetOptions(options);
+    REQUIRE(SolveKnapsack(g, weights, values, 250) >= optimum * 0.5);
+  }
+}
+
+TEST_CASE("DeadlineTest", "[mipsolver]")
+{
+  const char *engines[] = { "GLPK", "BNB" };
+  for (auto engine : engines)
+  {
+    MIPSolver s;
+    REQUIRE(s.SetEngine(engine));
+
+    std::vector<MIPSolver::Variable> x;
+    MIPSolver::Expression weight, value;
+    for (int i = 0; i < 30; i++)
+    {
+      x.push_back(s.GetIntegerVariable(5));
+      weight += (17 + i * 7 % 23) * x.back();
+      value += (11 + i * 13 % 29) * x.back();
+    }
+    s.Restrict(weight <= 500);
+
+    auto sol = s.Maximize(value);
+    REQUIRE(sol);
+    REQUIRE(sol.IsOptimal());
+    REQUIRE(sol.GetGap() == 0);
+    REQUIRE(sol.GetTermination() == MIPSolver::finished);
+
+    s.Restrict(weight <= 499);
+    auto start = s.Minimize(weight);
+    REQUIRE(start);
+
+    // Whatever the engine manages to do without time, the start is still a feasible answer
+    s.SetDeadline(MIPSolver::Clock::now());
+
+    auto res = s.Maximize(value, start);
+    REQUIRE(res);
+    REQUIRE(res(weight) <= 499);
+    REQUIRE(res(value) >= start(value));
+    if (!res.IsOptimal())
+    {
+      REQUIRE(res.GetTermination() == MIPSolver::timeout);
+      REQUIRE(res.GetGap() >= 0);
+    }
+  }
+}
+
+TEST_CASE("ReduceModelTest", "[mipsolver]")
+{
+  MIPSolver::Options options;
+  options.reduceModel = true;
+
+  SECTION("Same as without reduction")
+  {
+    // Big-M rows of the on-off items, a fixed item and a duplicate row are all reduced
+    auto build = [](MIPSolver &s, MIPSolver::Expression &weight, MIPSolver::Expression &value)
+    {
+      for (int i = 0; i < 12; i++)
+      {
+        auto x = s.GetIntegerVariable(3);
+        auto on = s.GetBinaryVariable();
+        s.Restrict(x <= 100 * on);
+        s.Restrict(x >= on);
+        weight += (10 + i * 7 % 31) * x;
+        value += (5 + i * 11 % 37) * x - 4 * on;
+      }
+
+      auto fixed = s.GetIntegerVariable(2, 2);
+      weight += 15 * fixed;
+      value += 9 * fixed;
+
+      s.Restrict(weight <= 200);
+      s.Restrict(2 * weight <= 400);
+    };
+
+    MIPSolver reference;
+    MIPSolver::Expression refWeight, refValue;
+    build(reference, refWeight, refValue);
+    auto expected = reference.Maximize(refValue);
+    REQUIRE(expected);
+
+    const char *engines[] = { "GLPK", "BNB" };
+    for (auto engine : engines)
+    {
+      MIPSolver s;
+      REQUIRE(s.SetEngine(engine));
+      s.SetOptions(options);
+
+      MIPSolver::Expression weight, value;
+      build(s, weight, value);
+
+      auto sol = s.Maximize(value);
+      REQUIRE(sol);
+      REQUIRE(sol.IsOptimal());
+      REQUIRE(sol(weight) <= 200 + 1e-6);
+      REQUIRE(sol(value) == Approx(expected(refValue)));
+
+      // The reduced model solves again from a start of the original one
+      auto again = s.Maximize(value, sol);
+      REQUIRE(again);
+      REQUIRE(again(value) == Approx(sol(value)));
+    }
+  }
+
+  SECTION("Infeasible")
+  {
+    MIPSolver s;
+    s.SetOptions(options);
+
+    auto x = s.GetIntegerVariable(10);
+    auto y = s.GetIntegerVariable(10);
+    s.Restrict(2 * x == 5);
+    REQUIRE_FALSE(s.Minimize(x + y));
+  }
+
+  SECTION("Squares")
+  {
+    MIPSolver s;
+    s.SetOptions(options);
+
+    auto x = s.GetIntegerVariable(-5, 5);
+    auto y = s.GetIntegerVariable(3, 3);
+    auto q = s.GetSquare(x - y + 0.4);
+
+    auto sol = s.Minimize(q);
+    REQUIRE(sol);
+    REQUIRE(sol(x) == Approx(3).margin(1e-6));
+    REQUIRE(sol(q) == Approx(0.16).margin(1e-6));
+  }
+}
+
+TEST_CASE("ModelDumpTest", "[mipsolver]")
+{
+  const std::string file = "model_dump_test.mps";
+
+  MIPSolver s;
+  std::vector<std::string> names;
+  s.SetModelDump([&]() -> std::string
+  {
+    names.push_back(names.empty() ? file : std::string());
+    return names.back();
+  });
+
+  MIPSolver::Expression weight, value;
+  for (int i = 0; i < 10; i++)
+  {
+    auto x = s.GetIntegerVariable(3);
+    weight += (10 + i * 7 % 31) * x;
+    value += (5 + i * 11 % 37) * x;
+  }
+  auto c = s.GetIntegerVariable(-2, 2);
+  s.Restrict(weight + c <= 100);
+  s.Restrict(weight - c >= 10);
+
+  auto sol = s.Maximize(value + c + 1);
+  REQUIRE(sol);
+  REQUIRE_FALSE(sol.GetStatistics().dumpFailed);
+  s.Maximize(value);
+  REQUIRE(names.size() == 2);
+
+  // A file that cannot be written is reported, the optimization goes on
+  MIPSolver unwritable = s;
+  unwritable.SetModelDump([]() -> std::string { return "no_such_directory/model.mps"; });
+  auto failed = unwritable.Maximize(value + c + 1);
+  REQUIRE(failed);
+  REQUIRE(failed.GetStatistics().dumpFailed);
+  REQUIRE(failed(value + c + 1) == Approx(sol(value + c + 1)));
+
+  // The dumped model is minimized, so its optimum is the negated maximum
+  MIPSolver loaded;
+  MIPSolver::Expression objective;
+  REQUIRE(loaded.LoadModel(file, objective));
+  auto replayed = loaded.Minimize(objective);
+  REQUIRE(replayed);
+  REQUIRE(replayed(objective) == Approx(-sol(value + c + 1)));
+
+  std::remove(file.c_str());
+
+  MIPSolver missing;
+  REQUIRE_FALSE(missing.LoadModel(file, objective));
+}
+
+TEST_CASE("StatisticsTest", "[mipsolver]")
+{
+  const char *engines[] = { "GLPK", "BNB" };
+  for (auto engine : engines)
+  {
+    // Iterations of GLPK on its presolved copy of the problem are not counted
+    MIPSolver::Options options;
+    options.presolve = false;
+
+    MIPSolver s;
+    REQUIRE(s.SetEngine(engine));
+    s.SetOptions(options);
+
+    MIPSolver::Expression weight, value;
+    for (int i = 0; i < 15; i++)
+    {
+      auto x = s.GetIntegerVariable(3);
+      weight += (10 + i * 7 % 31) * x;
+      value += (5 + i * 11 % 37) * x;
+    }
+    s.Restrict(weight <= 150);
+
+    auto sol = s.Maximize(value);
+    REQUIRE(sol);
+
+    const MIPSolver::Statistics &st = sol.GetStatistics();
+    REQUIRE(st.nodes == sol.GetNodeCount());
+    REQUIRE(st.nodes > 0);
+    REQUIRE(st.lpIterations > 0);
+    REQUIRE(st.gap == 0);
+    REQUIRE(st.variables == 16);
+    REQUIRE(st.conditions == 2);
+    REQUIRE(st.nonzeros == 16);
+    REQUIRE(st.buildTime >= 0);
+    REQUIRE(st.uploadTime >= 0);
+    REQUIRE(st.lpTime >= 0);
+    REQUIRE(st.searchTime >= 0);
+  }
+}
+
+TEST_CASE("LexicographicTest", "[mipsolver]")
+{
+  const char *engines[] = { "GLPK", "BNB" };
+  for (auto engine : engines)
+  {
+    MIPSolver s;
+    REQUIRE(s.SetEngine(engine));
+
+    auto x = s.GetIntegerVariable(10);
+    auto y = s.GetIntegerVariable(10);
+    s.Restrict(x + y >= 7);
+
+    auto sol = s.MinimizeLexicographic({ x + y, x - y });
+    REQUIRE(sol);
+    REQUIRE(sol.IsOptimal());
+    REQUIRE(sol(x) == Approx(0).margin(1e-6));
+    REQUIRE(sol(y) == Approx(7));
+
+    auto loose = s.MinimizeLexicographic({ x + y, x - y }, { 1, 0 });
+    REQUIRE(loose);
+    REQUIRE(loose(x - y) == Approx(-8));
+
+    // The levels do not restrict the model afterwards
+    auto free = s.Minimize(x - y);
+    REQUIRE(free);
+    REQUIRE(free(x - y) == Approx(-10));
+
+    // A built level sees the previous ones fixed, and what it adds is removed afterwards
+    std::vector<MIPSolver::Objective> levels =
+    {
+      [&]() -> MIPSolver::Expression { return x + y; },
+      [&]() -> MIPSolver::Expression { return s.GetAbsoluteValue(x - 3); },
+    };
+    auto built = s.MinimizeLexicographic(levels, {}, MIPSolver::Solution());
+    REQUIRE(built);
+    REQUIRE(built(x + y) == Approx(7));
+    REQUIRE(built(x) == Approx(3));
+    REQUIRE(built.GetStatistics().variables > 2);
+    REQUIRE(s.Minimize(x + y).GetStatistics().variables == 2);
+  }
+}
+
+TEST_CASE("AlternativesTest", "[mipsolver]")
+{
+  MIPSolver s;
+
+  std::vector<MIPSolver::Expression> items;
+  MIPSolver::Expression weight, value;
+  const int weights[] = { 5, 4, 6, 3 };
+  const int values[] = { 10, 40, 30, 50 };
+  for (int i = 0; i < 4; i++)
+  {
+    auto x = s.GetBinaryVariable();
+    items.push_back(x);
+    weight += weights[i] * x;
+    value += values[i] * x;
+  }
+  s.Restrict(weight <= 10);
+
+  auto sol = s.Minimize(-value);
+  REQUIRE(sol);
+  REQUIRE(sol(value) == Approx(90));
+
+  // The next best sets of items are worth 80 (the 3rd and the 4th) and 70 (the 2nd and the 3rd)
+  auto alts = s.FindAlternatives(-value, sol, items, 2);
+  REQUIRE(alts.size() == 2);
+  REQUIRE(alts[0](value) == Approx(80));
+  REQUIRE(alts[1](value) == Approx(70));
+
+  // All the feasible sets are found if more are asked for than there are
+  alts = s.FindAlternatives(-value, sol, items, 100);
+  REQUIRE(alts.size() == 9);
+  for (size_t i = 1; i < alts.size(); i++)
+  {
+    REQUIRE(alts[i](value) <= alts[i - 1](value) + 1e-6);
+  }
+
+  // The cuts are removed afterwards
+  REQUIRE(s.Minimize(-value)(value) == Approx(90));
+}
+
+TEST_CASE("HeuristicTest", "[mipsolver]")
+{
+  MIPSolver s;
+
+  std::vector<MIPSolver::Variable> items;
+  MIPSolver::Expression weight, value;
+  const int weights[] = { 6, 5, 4 };
+  const int values[] = { 13, 10, 7 };
+  for (int i = 0; i < 3; i++)
+  {
+    auto x = s.GetIntegerVariable(10);
+    items.push_back(x);
+    weight += weights[i] * x;
+    value += values[i] * x;
+  }
+  s.Restrict(weight <= 19);
+
+  // The relaxation takes 3 of the first items and a part of the second one, rounding it down is the optimum
+  int calls = 0;
+  s.SetHeuristic([&](const MIPSolver::Solution &relaxation, MIPSolver::Proposal &proposal)
+  {
+    calls++;
+    for (auto it = items.begin(); it != items.end(); it++)
+    {
+      proposal.Set(*it, floor(relaxation(*it) + 1e-6));
+    }
+    REQUIRE(proposal(weight) <= 19);
+    return true;
+  });
+
+  auto sol = s.Minimize(-value);
+  REQUIRE(sol);
+  REQUIRE(sol.IsOptimal());
+  REQUIRE(sol(value) == Approx(39));
+  REQUIRE(calls > 0);
+
+  // Reduced models propose through the source one
+  MIPSolver::Options options;
+  options.reduceModel = true;
+  s.SetOptions(options);
+  calls = 0;
+  REQUIRE(s.Minimize(-value)(value) == Approx(39));
+  REQUIRE(calls > 0);
+
+  // Infeasible proposals are ignored
+  s.SetOptions(MIPSolver::Options());
+  s.SetHeuristic([&](const MIPSolver::Solution &, MIPSolver::Proposal &proposal)
+  {
+    for (auto it = items.begin(); it != items.end(); it++)
+    {
+      proposal.Set(*it, 10);
+    }
+    return true;
+  });
+  sol = s.Minimize(-value);
+  REQUIRE(sol.IsOptimal());
+  REQUIRE(sol(value) == Approx(39));
+}
+
+TEST_CASE("BranchingPriorityTest", "[mipsolver]")
+{
+  // On-off items whose amounts follow the decisions, like deals of the optimizer
+  const char *engines[] = { "GLPK", "BNB" };
+  for (size_t e = 0; e < sizeof(engines) / sizeof(*engines); e++)
+  {
+    for (int priorities = 0; priorities < 2; priorities++)
+    {
+      MIPSolver s;
+      REQUIRE(s.SetEngine(engines[e]));
+
+      MIPSolver::Options options;
+      options.priorities = priorities != 0;
+      s.SetOptions(options);
+
+      MIPSolver::Expression cost, amount;
+      const int fixed[] = { 7, 3, 5, 4 };
+      const int prices[] = { 2, 5, 3, 4 };
+      for (int i = 0; i < 4; i++)
+      {
+        auto on = s.GetBinaryVariable();
+        auto x = s.GetIntegerVariable(10);
+        s.SetBranchingPriority(on, 1);
+        s.Restrict(x <= 10 * on);
+
+        cost += fixed[i] * on + prices[i] * x;
+        amount += x;
+      }
+      s.Restrict(amount >= 13);
+      s.Restrict(amount <= 13.5);
+
+      // Ten of the first item and three of the third one
+      auto sol = s.Minimize(cost);
+      REQUIRE(sol);
+      REQUIRE(sol.IsOptimal());
+      REQUIRE(sol(cost) == Approx(41));
+      REQUIRE(sol(amount) == Approx(13));
+    }
+  }
+}
+
+TEST_CASE("LazyConditionTest", "[mipsolver]")
+{
+  const char *engines[] = { "GLPK", "BNB" };
+  for (size_t e = 0; e < sizeof(engines) / sizeof(*engines); e++)
+  {
+    MIPSolver s;
+    REQUIRE(s.SetEngine(engines[e]));
+
+    std::vector<MIPSolver::Variable> items;
+    MIPSolver::Expression weight, value;
+    const int weights[] = { 5, 4, 6, 3 };
+    const int values[] = { 10, 40, 30, 50 };
+    for (int i = 0; i < 4; i++)
+    {
+      auto x = s.GetBinaryVariable();
+      items.push_back(x);
+      weight += weights[i] * x;
+      value += values[i] * x;
+    }
+    s.Restrict(weight <= 10);
+    REQUIRE(s.Minimize(-value)(value) == Approx(90));
+
+    // The lazy conditions are met only where they are violated, but still hold for the result
+    auto cp = s.CreateCheckpoint();
+    s.RestrictLazily(items[1] + items[3] <= 1);
+    s.RestrictLazily(items[0] + items[2] <= 1);
+    auto sol = s.Minimize(-value);
+    REQUIRE(sol);
+    REQUIRE(sol.IsOptimal());
+    REQUIRE(sol(value) == Approx(80));
+    REQUIRE(sol(items[1] + items[3]) <= 1);
+
+    // They are rolled back like the others
+    s.Rollback(cp);
+    REQUIRE(s.Minimize(-value)(value) == Approx(90));
+  }
+}
+
+TEST_CASE("ReplaceConditionTest", "[mipsolver]")
+{
+  const char *engines[] = { "GLPK", "BNB" };
+  for (size_t e = 0; e < sizeof(engines) / sizeof(*engines); e++)
+  {
+    MIPSolver s;
+    REQUIRE(s.SetEngine(engines[e]));
+
+    std::vector<MIPSolver::Variable> items;
+    MIPSolver::Expression weight, value;
+    const int weights[] = { 5, 4, 6, 3 };
+    const int values[] = { 10, 40, 30, 50 };
+    for (int i = 0; i < 4; i++)
+    {
+      auto x = s.GetBinaryVariable();
+      items.push_back(x);
+      weight += weights[i] * x;
+      value += values[i] * x;
+    }
+    size_t capacity = s.Restrict(weight <= 10);
+    auto sol = s.Minimize(-value);
+    REQUIRE(sol(value) == Approx(90));
+
+    // The previous solution is still feasible and starts the search
+    s.Replace(capacity, weight <= 13);
+    sol = s.Minimize(-value, sol);
+    REQUIRE(sol.IsOptimal());
+    REQUIRE(sol(value) == Approx(120));
+
+    // Now it is not and is ignored
+    s.SetBounds(items[3], 0, 0);
+    sol = s.Minimize(-value, sol);
+    REQUIRE(sol.IsOptimal());
+    REQUIRE(sol(value) == Approx(70));
+
+    // Changes of the rolled back part are dropped with it
+    auto cp = s.CreateCheckpoint();
+    size_t extra = s.Restrict(items[1] <= 0);
+    REQUIRE(extra == capacity + 1);
+    REQUIRE(s.Minimize(-value)(value) == Approx(40));
+    s.Replace(extra, items[2] <= 0);
+    s.Rollback(cp);
+
+    s.SetBounds(items[3], 0, 1);
+    REQUIRE(s.Minimize(-value)(value) == Approx(120));
+  }
+}
+
+TEST_CASE("MatrixUploadBenchmark", "[mipsolver][.benchmark]")
+{
+  // Each row references a fixed number of columns, so the number of nonzeros
+  // grows linearly with the model size while the dense matrix grows quadratically
+
+  const size_t nonzerosPerRow = 8;
+
+  double firstCost = 0;
+  for (size_t n = 1000; n <= 16000; n *= 2)
+  {
+    MIPSolver s;
+
+    std::vector<MIPSolver::Variable> x(n);
+    for (size_t i = 0; i < n; i++)
+    {
+      x[i] = s.GetIntegerVariable(1);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+      MIPSolver::Expression row;
+      for (size_t j = 0; j < nonzerosPerRow; j++)
+      {
+        row += x[(i + j * 97) % n] * static_cast<double>(j + 1);
+      }
+      s.Restrict(row <= 1000);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto sol = s.Minimize(0);
+    auto finish = std::chrono::steady_clock::now();
+    REQUIRE(sol);
+
+    double seconds = std::chrono::duration<double>(finish - start).count();
+    double cost = seconds / (n * nonzerosPerRow);
+    if (firstCost == 0) firstCost = cost;
+
+    std::cout << n * nonzerosPerRow << " nonzeros: " << seconds * 1000 << " ms, ";
+    std::cout << cost * 1e9 << " ns per nonzero" << std::endl;
+
+    CHECK(cost < firstCost * 4);
+  }
+}
+
+namespace
+{
+  // The former storage of MIPSolver::Expression, kept as the reference for the benchmark
+  struct MapExpression
+  {
+    std::map<size_t, double> f;
+    double c = 0;
+
+    MapExpression(double c = 0) : c(c) { }
+    MapExpression(size_t index, double k) { f[index] = k; }
+
+    MapExpression operator +(const MapExpression &e) const { return MapExpression(*this) += e; }
+    MapExpression operator *(double n) const { return MapExpression(*this) *= n; }
+
+    MapExpression &operator +=(const MapExpression &e)
+    {
+      for (auto it = e.f.begin(); it != e.f.end(); it++) f[it->first] += it->second;
+      c += e.c;
+      return *this;
+    }
+
+    MapExpression &operator -=(const MapExpression &e)
+    {
+      return *this += e * -1;
+    }
+
+    MapExpression &operator *=(double n)
+    {
+      for (auto it = f.begin(); it != f.end(); it++) f[it->first] *= n;
+      c *= n;
+      return *this;
+    }
+  };
+
+  size_t CountTerms(const MapExpression &expr)
+  {
+    return expr.f.size();
+  }
+
+  size_t CountTerms(const MIPSolver::Expression &expr)
+  {
+    return expr.GetFactors().size();
+  }
+
+  template<class Expression, class Variable>
+  size_t BuildRebalanceExpressions(const std::vector<Variable> &vars)
+  {
+    // The same shape of expressions as Optimizer builds: cash, total volume and per-asset deviations
+    size_t assets = vars.size() / 2;
+
+    Expression cash = 1000;
+    std::vector<Expression> count(assets);
+    for (size_t i = 0; i < assets; i++)
+    {
+      const Variable &buy = vars[2 * i];
+      const Variable &sell = vars[2 * i + 1];
+
+      count[i] = 10;
+      count[i] += buy;
+      count[i] -= sell;
+
+      cash -= buy * 12.5;
+      cash += sell * 12.25;
+      cash -= (buy + sell) * 1.;
+    }
+
+    Expression volume = cash;
+    for (size_t i = 0; i < assets; i++)
+    {
+      volume += count[i] * 12.25;
+    }
+
+    size_t terms = 0;
+    for (size_t i = 0; i < assets; i++)
+    {
+      Expression diff = count[i] * 12.25 + volume * -0.01;
+      terms += CountTerms(diff);
+    }
+    return terms;
+  }
+
+}
+
+TEST_CASE("ExpressionBenchmark", "[mipsolver][.benchmark]")
+{
+  const size_t assets = 500;
+  const int repeats = 5;
+
+  MIPSolver s;
+  std::vector<MIPSolver::Variable> vars(2 * assets);
+  std::vector<MapExpression> mapVars(2 * assets);
+  for (size_t i = 0; i < vars.size(); i++)
+  {
+    vars[i] = s.GetIntegerVariable(100);
+    mapVars[i] = MapExpression(i + 1, 1);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  size_t mapTerms = 0;
+  for (int i = 0; i < repeats; i++)
+  {
+    mapTerms = BuildRebalanceExpressions<MapExpression>(mapVars);
+  }
+  auto middle = std::chrono::steady_clock::now();
+  size_t terms = 0;
+  for (int i = 0; i < repeats; i++)
+  {
+    terms = BuildRebalanceExpressions<MIPSolver::Expression>(vars);
+  }
+  auto finish = std::chrono::steady_clock::now();
+
+  REQUIRE(terms == mapTerms);
+
+  double mapSeconds = std::chrono::duration<double>(middle - start).count();
+  double seconds = std::chrono::duration<double>(finish - middle).count();
+
+  std::cout << "std::map storage: " << terms * repeats / mapSeconds << " terms per second" << std::endl;
+  std::cout << "Flat storage:     " << terms * repeats / seconds << " terms per second" << std::endl;
+
+  CHECK(seconds < mapSeconds);
+}
@@ -23,10 +23,13 @@
 #include "optimizer.h"
 
 #include <catch.hpp>
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <iostream>
 #include <map>
 #include <sstream>
+#include <thread>
 
 #define HAVE(...) "[have]",       __VA_ARGS__
 #define WANT(...) "[want]",       __VA_ARGS__
@@ -141,17 +144,22 @@ Optimizer Optimize(const Allocation &a, bool expected = true, bool checkq = true
 
   Optimizer o
   (
+#ifdef _DEBUG
     [](size_t iter, int nodes, double progress) -> bool
     {
-#ifdef _DEBUG
       std::cout << iter << ", " << nodes << ", " << int(progress * 100) << "%  ";
       if (progress == 1)
         std::cout << std::endl;
       else
         std::cout << "\r";
-#endif
       return true;
     }
+#else
+    [](size_t, int, double) -> bool
+    {
+      return true;
+    }
+#endif
   );
 
   bool ok = o.Optimize(a, GetRatesProvider());
@@ -295,6 +303,24 @@ TEMPLATE_TEST_CASE("SimpleTest", "[optimizer]", LadTestType, LsTestType)
   REQUIRE_FALSE(res.inPercents);
 }
 
+TEMPLATE_TEST_CASE("SourceQualityTest", "[optimizer]", LadTestType, LsTestType)
+{
+  // The source is worth 10 + 20, so both assets are 5 away from the targets of 15
+  Optimizer o = Optimize<TestType>(HAVE("ONE = 10", "TWO = 10"), WANT("ONE = 50%", "TWO = 50%"));
+  auto qs = o.GetSourceQuality();
+  REQUIRE(qs.abserr == Approx(5));
+  REQUIRE(qs.stddev == Approx(5));
+  REQUIRE(o.GetResult("ONE").sourcePercents == Approx(100. / 3));
+  REQUIRE(o.GetResult("TWO").sourcePercents == Approx(200. / 3));
+
+  // Cash is a part of the source too
+  o = Optimize<TestType>(HAVE("TEN = 3"), WANT("TEN = 50%"), CASH("have = 10", "want = 50%"));
+  qs = o.GetSourceQuality();
+  REQUIRE(qs.abserr == Approx(10));
+  REQUIRE(qs.stddev == Approx(10));
+  REQUIRE(o.GetCashResult().sourcePercents == Approx(25));
+}
+
 TEMPLATE_TEST_CASE("FracTest", "[optimizer]", LadTestType, LsTestType)
 {
   Optimizer o1 = Optimize<TestType>(HAVE("ONE = 3.4"), WANT("ONE = 1.6"), CASH("withdraw = 1"));
@@ -1465,6 +1491,427 @@ TEMPLATE_TEST_CASE("BigTest", "[optimizer][.heavy]", LadTestType, LsTestType)
 }
 #endif
 
+TEMPLATE_TEST_CASE("AlternativesTest", "[optimizer]", LadTestType, LsTestType)
+{
+  Optimizer o = Optimize<TestType>(HAVE("VTI = 10", "IEF = 2", "BND = 5"), WANT("VTI = 40%", "IEF = 30%", "BND = 30%"),
+    CASH("have = 500"), OPTS("alternatives = 3"));
+
+  REQUIRE(o.GetAlternativeCount() > 0);
+  REQUIRE(o.GetAlternativeCount() <= 3);
+
+  const char *tickers[] = { "VTI", "IEF", "BND" };
+  for (size_t k = 0; k < o.GetAlternativeCount(); k++)
+  {
+    // Every alternative makes other deals than the result
+    bool different = false;
+    for (auto ticker : tickers)
+    {
+      const Optimizer::Result &r = o.GetAlternativeResult(k, ticker);
+      REQUIRE(r.have == o.GetResult(ticker).have);
+      different = different || (r.change != 0) != (o.GetResult(ticker).change != 0) ||
+        (r.change > 0) != (o.GetResult(ticker).change > 0);
+    }
+    REQUIRE(different);
+    REQUIRE(o.GetAlternativeCashResult(k).result >= 0);
+
+    // LAD ranks by the exact deviation, the approximation of squares is not exact
+    if (!isLsTest<TestType>())
+    {
+      double previous = k == 0 ? o.GetResultQuality().abserr : o.GetAlternativeQuality(k - 1).abserr;
+      REQUIRE(o.GetAlternativeQuality(k).abserr >= previous - 1e-6);
+    }
+  }
+}
+
+TEST_CASE("ConcurrentOptimizationTest", "[optimizer][.heavy]")
+{
+  // Catch assertions are not thread safe, so the threads only optimize and everything is checked here
+  std::vector<Allocation> allocations;
+  for (int i = 0; i < 300; i++)
+  {
+    std::stringstream ss;
+    ss << "[have]\nVTI = " << i % 7 << "\nIEF = " << i % 5 << "\nBND = " << i % 3 << "\n";
+    ss << "[want]\nVTI = " << 20 + i % 30 << "%\nIEF = 30%\nBND = " << 50 - i % 30 << "%\n";
+    ss << "[cash]\nhave = " << 100 + 37 * (i % 50) << "\n";
+    ss << "[options]\ncommission = 1\nmodel = " << (i % 3 == 0 ? "lad" : i % 3 == 1 ? "lsapprox" : "ls") << "\n";
+
+    Allocation a;
+    REQUIRE(a.Load(ss));
+    allocations.push_back(a);
+  }
+
+  auto rates = [](const std::string &ticker, double &bid, double &ask)
+  {
+    bid = ask = ticker == "VTI" ? 116.71 : ticker == "IEF" ? 103.81 : 80.20;
+  };
+
+  std::vector<double> expected(allocations.size());
+  for (size_t i = 0; i < allocations.size(); i++)
+  {
+    Optimizer o;
+    REQUIRE(o.Optimize(allocations[i], rates));
+    expected[i] = o.GetResultQuality().stddev;
+  }
+
+  std::vector<double> stddev(allocations.size(), -1);
+  std::atomic<size_t> next(0);
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < std::max(std::thread::hardware_concurrency(), 4u); t++)
+  {
+    threads.push_back(std::thread([&]()
+    {
+      for (size_t i = next++; i < allocations.size(); i = next++)
+      {
+        Optimizer o;
+        if (o.Optimize(allocations[i], rates))
+        {
+          stddev[i] = o.GetResultQuality().stddev;
+        }
+      }
+    }));
+  }
+
+  for (auto it = threads.begin(); it != threads.end(); it++)
+  {
+    it->join();
+  }
+
+  for (size_t i = 0; i < allocations.size(); i++)
+  {
+    REQUIRE(stddev[i] == Approx(expected[i]).margin(1e-6));
+  }
+}
+
+TEMPLATE_TEST_CASE("BatchTest", "[optimizer]", LadTestType, LsTestType)
+{
+  std::vector<Allocation> allocations;
+  for (int i = 0; i < 12; i++)
+  {
+    std::ostringstream have, want, cash;
+    have << "VTI = " << i % 4;
+    want << "IEF = " << 10 + i * 5 << "%";
+    cash << "have = " << 500 + 250 * i;
+
+    if (i % 3 == 0)
+    {
+      allocations.push_back(CreateAllocation<TestType>(HAVE(have.str()), WANT("VTI = 50%", want.str()), CASH(cash.str())));
+    }
+    else
+    {
+      allocations.push_back(CreateAllocation<TestType>(HAVE(have.str(), "BND = 2", "VNQ = 1"),
+        WANT("VTI = 30%", "BND = 20%", "VNQ = 10%", want.str()), CASH(cash.str())));
+    }
+  }
+
+  // The rates are read once per ticker
+  Optimizer::RatesProvider rates = GetRatesProvider();
+  std::map<std::string, int> calls;
+  auto counted = [&](const std::string &ticker, double &bid, double &ask)
+  {
+    calls[ticker]++;
+    rates(ticker, bid, ask);
+  };
+
+  auto results = Optimizer::OptimizeBatch(allocations, counted, 3);
+  REQUIRE(results.size() == allocations.size());
+  REQUIRE(calls.size() == 4);
+  for (auto it = calls.begin(); it != calls.end(); it++)
+  {
+    REQUIRE(it->second == 1);
+  }
+
+  for (size_t i = 0; i < allocations.size(); i++)
+  {
+    Optimizer o = Optimize(allocations[i]);
+
+    REQUIRE(results[i].ok);
+    REQUIRE(results[i].seconds >= 0);
+    REQUIRE(results[i].optimizer.GetResultQuality().stddev == Approx(o.GetResultQuality().stddev));
+    REQUIRE(results[i].optimizer.GetCashResult().result == Approx(o.GetCashResult().result));
+    for (size_t j = 0; j < allocations[i].GetCount(); j++)
+    {
+      const std::string &ticker = allocations[i].GetTicker(j);
+      REQUIRE(results[i].optimizer.GetResult(ticker).result == o.GetResult(ticker).result);
+    }
+  }
+
+  REQUIRE(Optimizer::OptimizeBatch(std::vector<Allocation>(), counted).empty());
+}
+
+TEMPLATE_TEST_CASE("TerminationTest", "[optimizer]", LadTestType, LsTestType)
+{
+  Allocation a = CreateAllocation<TestType>(HAVE("VTI = 6", "VNQ = 7", "VWO = 17"),
+    WANT("VTI = 40%", "VNQ = 30%", "VWO = 30%"), CASH("have = 1000"));
+
+  Optimizer o;
+  REQUIRE(o.Optimize(a, GetRatesProvider()));
+  REQUIRE(o.IsOptimal());
+  REQUIRE(o.GetTermination() == MIPSolver::finished);
+  REQUIRE(o.GetGap() == 0);
+
+  // Nothing is searched after the deadline, so without a previous plan the portfolio stays as it is
+  Optimizer expired;
+  expired.SetDeadline(MIPSolver::Clock::now() - std::chrono::seconds(1));
+  REQUIRE(!expired.Optimize(a, GetRatesProvider()));
+  REQUIRE(!expired.IsOptimal());
+  REQUIRE(expired.GetTermination() == MIPSolver::timeout);
+  REQUIRE(std::isinf(expired.GetGap()));
+
+  const char *tickers[] = { "VTI", "VNQ", "VWO" };
+  for (auto ticker : tickers)
+  {
+    REQUIRE(expired.GetResult(ticker).result == expired.GetResult(ticker).have);
+    REQUIRE(expired.GetResult(ticker).change == 0);
+  }
+  REQUIRE(expired.GetCashResult().result == 1000);
+  REQUIRE(expired.GetResultQuality().stddev == expired.GetSourceQuality().stddev);
+  REQUIRE(expired.GetResultQuality().abserr == expired.GetSourceQuality().abserr);
+}
+
+TEMPLATE_TEST_CASE("RoundingHeuristicTest", "[optimizer]", LadTestType, LsTestType)
+{
+  std::vector<std::string> portfolio =
+  {
+    "[have]", "VTI = 6", "VNQ = 7", "VWO = 17", "TLT = 4",
+    "[want]", "VTI = 30%", "VNQ = 20%", "VWO = 20%", "TLT = 30%",
+    "[cash]", "have = 1000",
+    "[options]", "max deals = 3",
+  };
+
+  Optimizer plain = Optimize(CreateAllocation<TestType>(portfolio));
+
+  portfolio.push_back("[solver]");
+  portfolio.push_back("rounding heuristic = yes");
+  Optimizer rounded = Optimize(CreateAllocation<TestType>(portfolio));
+
+  // Only the search differs, equally good plans may be found
+  REQUIRE(rounded.IsOptimal());
+  REQUIRE(rounded.GetResultQuality().stddev == Approx(plain.GetResultQuality().stddev).epsilon(1e-3));
+  REQUIRE(rounded.GetCashResult().result >= 0);
+}
+
+TEMPLATE_TEST_CASE("ReoptimizationTest", "[optimizer]", LadTestType, LsTestType)
+{
+  Allocation a = CreateAllocation<TestType>(HAVE("VTI = 6", "VNQ = 7", "VWO = 17"),
+    WANT("VTI = 40%", "VNQ = 30%", "VWO = 30%"), CASH("have = 1000"));
+
+  // The rates move by a few percent, except for the one at which nothing can be bought
+  struct
+  {
+    double vti;
+    double vnq;
+    double vwo;
+  }
+  moves[] =
+  {
+    { 1.02, 0.97, 1.01 },
+    { 0.95, 1.03, 0.98 },
+    { 1, 1, 1000 },
+    { 1.01, 1.01, 1.01 },
+    { 1, 1, 1 },
+  };
+
+  Optimizer::RatesProvider rates = GetRatesProvider();
+  Optimizer o;
+  REQUIRE(o.Optimize(a, rates));
+
+  for (size_t i = 0; i < sizeof(moves) / sizeof(*moves); i++)
+  {
+    std::map<std::string, double> k = { { "VTI", moves[i].vti }, { "VNQ", moves[i].vnq }, { "VWO", moves[i].vwo } };
+    Optimizer::RatesProvider moved = [&](const std::string &ticker, double &bid, double &ask)
+    {
+      rates(ticker, bid, ask);
+      bid *= k[ticker];
+      ask *= k[ticker];
+    };
+
+    REQUIRE(o.Reoptimize(moved));
+    REQUIRE(o.IsOptimal());
+
+    // The same as from scratch, up to the choice among equally good plans
+    Optimizer fresh;
+    REQUIRE(fresh.Optimize(a, moved));
+    if (!isLsTest<TestType>())
+    {
+      REQUIRE(o.GetResultQuality().abserr == Approx(fresh.GetResultQuality().abserr));
+    }
+    REQUIRE(o.GetResultQuality().stddev == Approx(fresh.GetResultQuality().stddev).epsilon(1e-3));
+    REQUIRE(o.GetSourceQuality().stddev == Approx(fresh.GetSourceQuality().stddev));
+
+    for (size_t j = 0; j < a.GetCount(); j++)
+    {
+      const std::string &ticker = a.GetTicker(j);
+      REQUIRE(o.GetResult(ticker).bid == fresh.GetResult(ticker).bid);
+      REQUIRE(o.GetResult(ticker).ask == fresh.GetResult(ticker).ask);
+    }
+    REQUIRE(o.GetCashResult().result >= 0);
+  }
+}
+
+TEST_CASE("LsConvergenceTest", "[optimizer]")
+{
+  std::vector<std::string> portfolio =
+  {
+    "[have]", "vti=6", "vnq=7", "vwo=17", "tlt=4", "ief=3", "iau=25",
+    "[want]", "VTI = 20%", "VNQ = 20%", "VWO = 20%", "TLT = 20%", "IEF = 10%", "IAU = 10%",
+    "[cash]", "have=1000",
+    "[solver]",
+  };
+
+  struct
+  {
+    const char *settings;
+    double tolerance;
+    size_t maxIterations;
+  }
+  cases[] =
+  {
+    { "refpoint tolerance = 0.5", 0.5, 0 },
+    { "refpoint tolerance = 20", 20, 0 },
+    { "multiscale refpoints = yes", 0.5, 0 },
+    { "max iterations = 2", 0.5, 2 },
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); i++)
+  {
+    std::vector<std::string> lines = portfolio;
+    lines.push_back(cases[i].settings);
+    Optimizer o = Optimize(CreateAllocation<LsTestType>(lines));
+
+    const std::vector<Optimizer::Convergence> &c = o.GetConvergence();
+    REQUIRE(!c.empty());
+    for (size_t j = 0; j < c.size(); j++)
+    {
+      // The approximation is never above the squares
+      REQUIRE(c[j].exact >= c[j].approximation - 1e-6);
+    }
+
+    if (cases[i].maxIterations > 0)
+    {
+      REQUIRE(c.size() <= cases[i].maxIterations);
+      continue;
+    }
+
+    // Converged within twice the tolerance of every deviation, which is the width of the rounding buckets
+    // of refpoints (6 assets and no cash target)
+    double distance = 2 * cases[i].tolerance;
+    REQUIRE(c.back().added == 0);
+    REQUIRE(c.back().exact - c.back().approximation <= 6 * distance * distance + 1e-6);
+    REQUIRE(c.back().exact == Approx(6 * o.GetResultQuality().stddev * o.GetResultQuality().stddev));
+  }
+}
+
+TEST_CASE("ExactLsTest", "[optimizer]")
+{
+  std::vector<std::vector<std::string>> portfolios =
+  {
+    {
+      "[want]", "VTI = 20%", "VNQ = 20%", "VWO = 20%", "TLT = 20%", "IEF = 10%", "IAU = 10%",
+      "[cash]", "have = 4085", "want = 0",
+      "[options]", "commission = 2",
+    },
+    {
+      "[have]", "vti=6", "vnq=7", "vwo=17", "tlt=4", "ief=3", "iau=25",
+      "[want]", "VTI = 20%", "VNQ = 20%", "VWO = 20%", "TLT = 20%", "IEF = 10%", "IAU = 10%",
+      "[cash]", "have=100",
+      "[options]", "no more deals=true",
+    },
+  };
+
+  for (size_t i = 0; i < portfolios.size(); i++)
+  {
+    Optimizer approx = Optimize(CreateAllocation<LsTestType>(portfolios[i]));
+
+    std::vector<std::string> lines = portfolios[i];
+    lines.push_back("[options]");
+    lines.push_back("model = ls");
+    Optimizer exact = Optimize(CreateAllocation<LsTestType>(lines));
+
+    // The exact model minimizes the sum of squares, and so the standard deviation (up to the tangent tolerance)
+    double stddev = approx.GetResultQuality().stddev;
+    REQUIRE(exact.GetResultQuality().stddev <= stddev + 1e-6 * (1 + stddev));
+  }
+}
+
+TEST_CASE("SquareEncodingBenchmark", "[optimizer][.benchmark]")
+{
+  std::vector<std::vector<std::string>> portfolios =
+  {
+    {
+      "[want]", "VTI = 20%", "VNQ = 20%", "VWO = 20%", "TLT = 20%", "IEF = 10%", "IAU = 10%",
+      "[cash]", "have = 4085", "want = 0",
+      "[options]", "commission = 2",
+    },
+    {
+      "[have]", "vti=6", "vnq=7", "vwo=17", "tlt=4", "ief=3", "iau=25",
+      "[want]", "VTI = 20%", "VNQ = 20%", "VWO = 20%", "TLT = 20%", "IEF = 10%", "IAU = 10%",
+      "[cash]", "have=100",
+      "[options]", "no more deals=true",
+    },
+    {
+      "[have]", "vti=6000", "vnq=7000", "vwo=17000", "tlt=4000", "ief=3000", "iau=25000",
+      "[want]", "VTI = 20%", "VNQ = 20%", "VWO = 20%", "TLT = 20%", "IEF = 10%", "IAU = 10%",
+      "[cash]", "have=44790",
+      "[options]", "commission=15", "no more deals=true",
+    },
+  };
+
+  for (size_t i = 0; i < portfolios.size(); i++)
+  {
+    const char *encodings[] = { "segments", "logarithmic", "convex" };
+    for (size_t j = 0; j < sizeof(encodings) / sizeof(*encodings); j++)
+    {
+      std::vector<std::string> lines = portfolios[i];
+      lines.push_back("[solver]");
+      lines.push_back(std::string("encoding = ") + encodings[j]);
+
+      auto start = std::chrono::steady_clock::now();
+      Optimizer o = Optimize(CreateAllocation<LsTestType>(lines));
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      std::cout << "Portfolio " << i + 1 << ", " << encodings[j] << " encoding: "
+        << o.GetNodeCount() << " nodes, " << seconds << " s, stddev " << o.GetResultQuality().stddev << std::endl;
+    }
+  }
+}
+
+TEMPLATE_TEST_CASE("BranchingPriorityBenchmark", "[optimizer][.benchmark]", LadTestType, LsTestType)
+{
+  std::vector<std::vector<std::string>> portfolios =
+  {
+    {
+      "[want]", "VTI = 20%", "VNQ = 20%", "VWO = 20%", "TLT = 20%", "IEF = 10%", "IAU = 10%",
+      "GOOG = 1", "TSLA = 1", "O = 1",
+      "[cash]", "have = 4085", "want = 0",
+    },
+    {
+      "[have]", "vti=6000", "vnq=7000", "vwo=17000", "tlt=4000", "ief=3000", "iau=25000",
+      "[want]", "VTI = 20%", "VNQ = 20%", "VWO = 20%", "TLT = 20%", "IEF = 10%", "IAU = 10%",
+      "[cash]", "have=44790",
+      "[options]", "commission=15", "no more deals=true",
+    },
+  };
+
+  for (size_t i = 0; i < portfolios.size(); i++)
+  {
+    const char *priorities[] = { "no", "yes" };
+    for (size_t j = 0; j < sizeof(priorities) / sizeof(*priorities); j++)
+    {
+      std::vector<std::string> lines = portfolios[i];
+      lines.push_back("[solver]");
+      lines.push_back(std::string("branching priorities = ") + priorities[j]);
+
+      auto start = std::chrono::steady_clock::now();
+      Optimizer o = Optimize(CreateAllocation<TestType>(lines));
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      std::cout << "Portfolio " << i + 1 << ", priorities " << priorities[j] << ": "
+        << o.GetNodeCount() << " nodes, " << seconds << " s, stddev " << o.GetResultQuality().stddev << std::endl;
+    }
+  }
+}
+
 TEMPLATE_TEST_CASE("LadIsBad", "[optimizer]", LadTestType, LsTestType)
 {
   #define ALLOCATION \